@@ -0,0 +1,377 @@
+#define _GNU_SOURCE // sched_setaffinity() and CPU_SET
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include "thread.h"
+
+/* micro-benchmarks de la bibliothèque, comparables aux pthreads
+ *
+ * le même source est compilé avec la bibliothèque 1:N (bench-thread), M:N
+ * (bench-thread-mn) et les pthreads (bench-pthread, -DUSE_PTHREAD).
+ * chaque benchmark mesure un lot d'opérations par échantillon: quelques
+ * échantillons de chauffe sont jetés, puis on garde la médiane, le 99e
+ * centile, la moyenne et l'écart type des temps par opération. l'intervalle
+ * de confiance à 95% de la médiane est tiré des statistiques d'ordre, il ne
+ * suppose rien sur la distribution des temps.
+ *
+ * tous les threads noyau du processus sont placés sur un seul CPU (-c), pour
+ * que les pthreads se partagent un processeur comme les threads 1:N.
+ *
+ * usage: bench [-n échantillons] [-w chauffe] [-c cpu|-1] [-j] [benchmark...]
+ * -j écrit les résultats en JSON sur la sortie standard, lu par compare.py.
+ *
+ * support nécessaire:
+ * - thread_create()/thread_join()
+ * - thread_yield() depuis ou vers le main
+ * - thread_mutex_lock()/thread_mutex_unlock()
+ */
+
+#ifndef BENCH_LIBRARY
+#define BENCH_LIBRARY "thread"
+#endif
+
+// operations per sample of each benchmark
+#define CREATE_JOIN_BATCH 1000
+#define YIELD_BATCH 10000
+#define MUTEX_BATCH 100000
+#define CONTENDED_THREADS 4
+#define CONTENDED_BATCH 1000
+#define SPAWN_TREE_DEPTH 8
+
+// quantile of the normal law for a 95% confidence interval
+#define Z_95 1.96
+
+struct bench {
+    const char *name;
+    const char *desc;
+    unsigned long batch;          // operations per sample
+    void (*run)(unsigned long n); // runs n operations
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* arrête le programme si une fonction de la bibliothèque a échoué, même
+ * compilé avec NDEBUG.
+ */
+static void check(int err, const char *what)
+{
+    if (err != 0) {
+        fprintf(stderr, "%s a échoué\n", what);
+        abort();
+    }
+}
+
+/*      create + join      */
+
+static void * nop(void *arg)
+{
+    return arg;
+}
+
+static void run_create_join(unsigned long n)
+{
+    thread_t th;
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        check(thread_create(&th, nop, NULL), "thread_create");
+        check(thread_join(th, NULL), "thread_join");
+    }
+}
+
+/*      aller-retour de yield entre le main et un fils      */
+
+static void * yielder(void *arg)
+{
+    unsigned long n = (uintptr_t)arg, i;
+
+    for (i = 0; i < n; i++)
+        thread_yield();
+    return NULL;
+}
+
+static void run_yield(unsigned long n)
+{
+    thread_t th;
+    unsigned long i;
+
+    check(thread_create(&th, yielder, (void *)(uintptr_t)n), "thread_create");
+    for (i = 0; i < n; i++)
+        thread_yield();
+    check(thread_join(th, NULL), "thread_join");
+}
+
+/*      mutex      */
+
+static thread_mutex_t mutex;
+static volatile unsigned long counter;
+
+static void run_mutex_uncontended(unsigned long n)
+{
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        thread_mutex_lock(&mutex);
+        counter++;
+        thread_mutex_unlock(&mutex);
+    }
+}
+
+/* chaque thread cède le processeur en section critique, les autres trouvent
+ * le mutex verrouillé et attendent.
+ */
+static void * locker(void *arg)
+{
+    unsigned long n = (uintptr_t)arg, i;
+
+    for (i = 0; i < n; i++) {
+        thread_mutex_lock(&mutex);
+        counter++;
+        thread_yield();
+        thread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+static void run_mutex_contended(unsigned long n)
+{
+    thread_t th[CONTENDED_THREADS];
+    int i;
+
+    for (i = 0; i < CONTENDED_THREADS; i++)
+        check(thread_create(&th[i], locker, (void *)(uintptr_t)(n / CONTENDED_THREADS)), "thread_create");
+    for (i = 0; i < CONTENDED_THREADS; i++)
+        check(thread_join(th[i], NULL), "thread_join");
+}
+
+/*      arbre binaire de threads      */
+
+static void * spawn_tree(void *arg)
+{
+    uintptr_t depth = (uintptr_t)arg;
+    thread_t left, right;
+
+    if (depth == 0)
+        return NULL;
+    check(thread_create(&left, spawn_tree, (void *)(depth - 1)), "thread_create");
+    check(thread_create(&right, spawn_tree, (void *)(depth - 1)), "thread_create");
+    check(thread_join(left, NULL), "thread_join");
+    check(thread_join(right, NULL), "thread_join");
+    return NULL;
+}
+
+// a tree of depth d has 2^(d+1) - 1 threads, the root included
+static void run_spawn_tree(unsigned long n)
+{
+    (void)n;
+    spawn_tree((void *)(uintptr_t)SPAWN_TREE_DEPTH);
+}
+
+static const struct bench benches[] = {
+    { "create_join", "thread_create() puis thread_join()", CREATE_JOIN_BATCH, run_create_join },
+    { "yield", "aller-retour de thread_yield() entre deux threads", YIELD_BATCH, run_yield },
+    { "mutex_uncontended", "lock/unlock d'un mutex libre", MUTEX_BATCH, run_mutex_uncontended },
+    { "mutex_contended", "lock/unlock d'un mutex disputé par 4 threads", CONTENDED_BATCH * CONTENDED_THREADS, run_mutex_contended },
+    { "spawn_tree", "thread d'un arbre binaire de profondeur 8", (2UL << SPAWN_TREE_DEPTH) - 1, run_spawn_tree },
+};
+
+#define NR_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/*      statistiques      */
+
+struct summary {
+    double median, ci_low, ci_high, p99, mean, stddev, min, max;
+};
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* résume n temps triés par ordre croissant.
+ * l'intervalle de la médiane va des rangs n/2 -+ 1.96 sqrt(n)/2 (approximation
+ * normale de la loi binomiale), le 99e centile est pris au rang le plus proche.
+ */
+static void summarize(const double *s, int n, struct summary *sum)
+{
+    double half = Z_95 * sqrt(n) / 2.0, var = 0.0;
+    int lo = (int)floor(n / 2.0 - half), hi = (int)ceil(n / 2.0 + half);
+    int i;
+
+    if (lo < 0)
+        lo = 0;
+    if (hi > n - 1)
+        hi = n - 1;
+
+    sum->median = n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2.0;
+    sum->ci_low = s[lo];
+    sum->ci_high = s[hi];
+    sum->p99 = s[(int)ceil(0.99 * n) - 1];
+    sum->min = s[0];
+    sum->max = s[n - 1];
+
+    sum->mean = 0.0;
+    for (i = 0; i < n; i++)
+        sum->mean += s[i];
+    sum->mean /= n;
+    for (i = 0; i < n; i++)
+        var += (s[i] - sum->mean) * (s[i] - sum->mean);
+    sum->stddev = n > 1 ? sqrt(var / (n - 1)) : 0.0;
+}
+
+static void measure(const struct bench *b, int warmup, int samples, struct summary *sum)
+{
+    double *s = malloc(samples * sizeof(*s));
+    uint64_t t0;
+    int i;
+
+    if (s == NULL) {
+        perror("malloc");
+        abort();
+    }
+    for (i = 0; i < warmup; i++)
+        b->run(b->batch);
+    for (i = 0; i < samples; i++) {
+        t0 = now_ns();
+        b->run(b->batch);
+        s[i] = (double)(now_ns() - t0) / b->batch;
+    }
+    qsort(s, samples, sizeof(*s), cmp_double);
+    summarize(s, samples, sum);
+    free(s);
+}
+
+/*      placement sur un CPU      */
+
+/* place sur cpu tous les threads noyau que le processus a déjà. les workers
+ * M:N n'en font pas partie: workers_start() les crée au premier thread_create(),
+ * après cet appel, et ils héritent alors de l'affinité de main.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+static int pin_cpu(int cpu)
+{
+    cpu_set_t set;
+    struct dirent *ent;
+    DIR *dir;
+    int err = 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    dir = opendir("/proc/self/task");
+    if (dir == NULL)
+        return sched_setaffinity(0, sizeof(set), &set);
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.')
+            continue;
+        if (sched_setaffinity(atoi(ent->d_name), sizeof(set), &set) != 0)
+            err = -1;
+    }
+    closedir(dir);
+    return err;
+}
+
+// first CPU the process may run on
+static int default_cpu(void)
+{
+    cpu_set_t set;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                return cpu;
+    return -1;
+}
+
+static void usage(const char *prog)
+{
+    unsigned int i;
+
+    fprintf(stderr, "usage: %s [-n échantillons] [-w chauffe] [-c cpu|-1] [-j] [benchmark...]\n", prog);
+    fprintf(stderr, "benchmarks:\n");
+    for (i = 0; i < NR_BENCHES; i++)
+        fprintf(stderr, "  %-18s %s\n", benches[i].name, benches[i].desc);
+}
+
+int main(int argc, char *argv[])
+{
+    int samples = 50, warmup = 5, cpu = default_cpu(), json = 0;
+    int selected[NR_BENCHES], any = 0, first = 1, opt, i;
+    unsigned int b;
+    struct summary sum;
+
+    memset(selected, 0, sizeof(selected));
+    while ((opt = getopt(argc, argv, "n:w:c:j")) != -1) {
+        switch (opt) {
+        case 'n': samples = atoi(optarg); break;
+        case 'w': warmup = atoi(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'j': json = 1; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (samples < 1 || warmup < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (i = optind; i < argc; i++) {
+        for (b = 0; b < NR_BENCHES; b++)
+            if (strcmp(argv[i], benches[b].name) == 0)
+                break;
+        if (b == NR_BENCHES) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        selected[b] = any = 1;
+    }
+
+    if (cpu >= 0 && pin_cpu(cpu) != 0) {
+        perror("sched_setaffinity");
+        return EXIT_FAILURE;
+    }
+    thread_mutex_init(&mutex);
+
+    if (json)
+        printf("{\n  \"library\": \"%s\",\n  \"cpu\": %d,\n  \"samples\": %d,\n  \"warmup\": %d,\n"
+               "  \"benchmarks\": [", BENCH_LIBRARY, cpu, samples, warmup);
+    else
+        printf("%s, CPU %d, %d échantillons après %d de chauffe (ns par opération)\n"
+               "%-18s %10s %21s %10s %10s %10s\n", BENCH_LIBRARY, cpu, samples, warmup,
+               "benchmark", "médiane", "IC 95%", "p99", "moyenne", "écart");
+
+    for (b = 0; b < NR_BENCHES; b++) {
+        if (any && !selected[b])
+            continue;
+        measure(&benches[b], warmup, samples, &sum);
+        if (json) {
+            printf("%s\n    { \"name\": \"%s\", \"unit\": \"ns/op\", \"batch\": %lu, "
+                   "\"median\": %.2f, \"median_ci\": [%.2f, %.2f], \"p99\": %.2f, "
+                   "\"mean\": %.2f, \"stddev\": %.2f, \"min\": %.2f, \"max\": %.2f }",
+                   first ? "" : ",", benches[b].name, benches[b].batch, sum.median,
+                   sum.ci_low, sum.ci_high, sum.p99, sum.mean, sum.stddev, sum.min, sum.max);
+            first = 0;
+        } else
+            printf("%-18s %10.1f [%9.1f, %9.1f] %10.1f %10.1f %10.1f\n", benches[b].name,
+                   sum.median, sum.ci_low, sum.ci_high, sum.p99, sum.mean, sum.stddev);
+        fflush(stdout);
+    }
+    if (json)
+        printf("\n  ]\n}\n");
+
+    thread_mutex_destroy(&mutex);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""Compares the JSON results of bench/bench.c against a baseline.
+
+usage: compare.py baseline.json result.json [result.json...]
+
+For each benchmark, prints the median of every result, its ratio to the
+baseline median and whether the difference is significant: the 95%
+confidence intervals of the two medians do not overlap.
+"""
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data["library"], {b["name"]: b for b in data["benchmarks"]}
+
+
+def main(argv):
+    if len(argv) < 3:
+        print(__doc__.strip(), file=sys.stderr)
+        return 1
+
+    base_name, base = load(argv[1])
+    for path in argv[2:]:
+        name, results = load(path)
+        print("%s vs %s (ns/op, median [95%% CI])" % (name, base_name))
+        for bench, r in results.items():
+            b = base.get(bench)
+            if b is None:
+                continue
+            lo, hi = r["median_ci"]
+            blo, bhi = b["median_ci"]
+            significant = hi < blo or bhi < lo
+            print("  %-18s %10.1f [%9.1f, %9.1f]  %10.1f [%9.1f, %9.1f]  x%-7.2f %s"
+                  % (bench, r["median"], lo, hi, b["median"], blo, bhi,
+                     r["median"] / b["median"] if b["median"] else float("inf"),
+                     "significatif" if significant else "non significatif"))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
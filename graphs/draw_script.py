@@ -99,4 +99,14 @@ if __name__ == "__main__":
     print("Exporting 33-switch-many-cascade graphs ...")
     get_graph("33-switch-many-cascade",  "$9; exit", 100, yields_max=100)
     print("Exporting 51-fibonacci graph ...")
-    get_graph("51-fibonacci", "$3 \"\\t\" $7", 27, threads_step=1)
\ No newline at end of file
+    get_graph("51-fibonacci", "$3 \"\\t\" $7", 27, threads_step=1)
+    print("Exporting 65-sem graph ...")
+    get_graph("65-sem", "$1 \"\\t\" $(NF-1)", 100)
+    print("Exporting 66-barrier graph ...")
+    get_graph("66-barrier", "$1 \"\\t\" $(NF-1)", 100)
+    print("Exporting 67-rwlock graph ...")
+    get_graph("67-rwlock", "$1 \"\\t\" $(NF-1)", 100)
+    print("Exporting 91-io-echo graph ...")
+    get_graph("91-io-echo", "$1 \"\\t\" $(NF-1)", 100)
+    print("Exporting 92-io-copy graph ...")
+    get_graph("92-io-copy", "$1 \"\\t\" $(NF-1)", 100)
\ No newline at end of file
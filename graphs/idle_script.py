@@ -0,0 +1,34 @@
+import os
+import re
+import subprocess
+from statistics import median
+
+# runs 73-idle with idle workers spinning from 0 to 200 us before blocking,
+# and prints the median wake-up lateness, round trip and CPU usage
+runs = 5
+spins_us = [0, 10, 20, 50, 100, 200]
+
+
+def run(cmd, spin_us, workers):
+    env = dict(os.environ, THREAD_IDLE_SPIN_US=str(spin_us), THREAD_WORKERS=str(workers))
+    late, trip, cpu = [], [], []
+    for _ in range(runs):
+        out = subprocess.run("./"+cmd, shell=True, env=env, capture_output=True, text=True).stdout
+        found = re.search(r"retard moyen (\d+) ns, \d+ allers-retours de (\d+) ns, CPU (\d+) %", out)
+        if found:
+            late.append(int(found.group(1)))
+            trip.append(int(found.group(2)))
+            cpu.append(int(found.group(3)))
+    return median(late), median(trip), median(cpu)
+
+
+def spin(name, cmd, workers=1):
+    print(name)
+    for spin_us in spins_us:
+        late, trip, cpu = run(cmd, spin_us, workers)
+        print("  spin :"+str(spin_us)+" us | lateness :"+str(late)+" ns | round trip :"+str(trip)+" ns | CPU :"+str(cpu)+" %")
+
+
+if __name__ == "__main__":
+    spin("73-idle 2000", "73-idle 2000")
+    spin("73-idle-mn 2000 (4 workers)", "73-idle-mn 2000", 4)
@@ -0,0 +1,38 @@
+import os
+import re
+import subprocess
+from statistics import median
+
+# runs the I/O tests with the io_uring and epoll backends, 1:N and M:N,
+# and with pthread when built, and prints the median time they report
+runs = 10
+sizes = [100, 1000, 5000]
+backends = [("io_uring", "1"), ("epoll", "0")]
+
+
+def run(cmd, env):
+    data = []
+    for _ in range(runs):
+        out = subprocess.run("./"+cmd, shell=True, env=env, capture_output=True, text=True).stdout
+        found = re.search(r"en (\d+) us", out)
+        if found:
+            data.append(int(found.group(1)))
+    return median(data) if data else None
+
+
+def compare(test):
+    print(test+" (us)")
+    for n in sizes:
+        line = "  "+str(n)+" :"
+        for name, value in backends:
+            for suffix in ["", "-mn"]:
+                env = dict(os.environ, THREAD_IO_URING=value)
+                line += " | "+name+suffix+" :"+str(run(test+suffix+" "+str(n), env))
+        if os.path.exists(test+"-pthread"):
+            line += " | pthread :"+str(run(test+"-pthread "+str(n), os.environ))
+        print(line)
+
+
+if __name__ == "__main__":
+    compare("91-io-echo")
+    compare("92-io-copy")
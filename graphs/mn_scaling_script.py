@@ -0,0 +1,30 @@
+import os
+from statistics import median
+
+# runs the M:N builds of fibonacci and switch-many with 1 to K kernel threads
+# and prints the median time and the speedup against a single worker
+runs = 10
+max_workers = os.cpu_count()
+
+
+def run(cmd, field, workers):
+    data = []
+    for _ in range(runs):
+        out = os.popen("THREAD_WORKERS="+str(workers)+" ./"+cmd+" 2>/dev/null").read().split()
+        data.append(float(out[field]))
+    return median(data)
+
+
+def scaling(name, cmd, field):
+    print(name)
+    base = None
+    for workers in range(1, max_workers+1):
+        t = run(cmd, field, workers)
+        if base is None:
+            base = t
+        print("  workers :"+str(workers)+" | median :"+str(t)+" | speedup :"+str(round(base/t, 2)))
+
+
+if __name__ == "__main__":
+    scaling("51-fibonacci-mn 22 (s)", "51-fibonacci-mn 22", 6)
+    scaling("31-switch-many-mn 100 10000 (us)", "31-switch-many-mn 100 10000", 5)
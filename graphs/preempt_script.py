@@ -0,0 +1,36 @@
+import os
+import subprocess
+import time
+from statistics import median
+
+# runs CPU-bound tests without preemption and with time slices from 1 to 50 ms
+# and prints the median wall time and the overhead against no preemption
+runs = 10
+quanta_ms = [0, 1, 2, 5, 10, 20, 50]
+
+
+def run(cmd, quantum_ms):
+    env = dict(os.environ, THREAD_PREEMPT_US=str(quantum_ms*1000))
+    data = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run("./"+cmd, shell=True, env=env,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        data.append(time.perf_counter() - start)
+    return median(data)
+
+
+def overhead(name, cmd):
+    print(name)
+    base = None
+    for quantum in quanta_ms:
+        t = run(cmd, quantum)
+        if base is None:
+            base = t
+        label = str(quantum)+" ms" if quantum else "off"
+        print("  quantum :"+label+" | median :"+str(round(t, 4))+" | overhead :"+str(round((t/base-1)*100, 2))+" %")
+
+
+if __name__ == "__main__":
+    overhead("71-preemption 2 (s)", "71-preemption 2")
+    overhead("51-fibonacci 22 (s)", "51-fibonacci 22")
@@ -0,0 +1,56 @@
+import os
+import re
+import subprocess
+import time
+from statistics import median
+
+# runs yield-heavy and CPU-bound tests with the FIFO and fair scheduling
+# policies, and prints the median throughput and share of the CPU
+runs = 5
+policies = ["fifo", "fair"]
+
+
+def run(cmd, policy, extra_env=None):
+    env = dict(os.environ, THREAD_SCHED=policy, **(extra_env or {}))
+    walls, outs = [], []
+    for _ in range(runs):
+        start = time.perf_counter()
+        res = subprocess.run("./"+cmd, shell=True, env=env, capture_output=True, text=True)
+        walls.append(time.perf_counter() - start)
+        outs.append(res.stdout + res.stderr)
+    return median(walls), outs
+
+
+def switches(name, cmd, workers=1):
+    print(name)
+    for policy in policies:
+        _, outs = run(cmd, policy, {"THREAD_WORKERS": str(workers)})
+        us = [int(m.group(1)) for m in (re.search(r": (\d+) us", o) for o in outs) if m]
+        print("  policy :"+policy+" | median :"+str(median(us))+" us")
+
+
+def share(name, cmd):
+    print(name)
+    for policy in policies:
+        _, outs = run(cmd+(" fair" if policy == "fair" else ""), policy)
+        ratios = [float(m.group(1)) for m in (re.search(r"rapport ([0-9.]+)", o) for o in outs) if m]
+        print("  policy :"+policy+" | median min/max work :"+str(median(ratios)))
+
+
+def preemption(name, cmd):
+    print(name)
+    for policy in policies:
+        wall, outs = run(cmd, policy, {"THREAD_PREEMPT_US": "10000"})
+        # alternations between the ids printed by the threads
+        alternations = []
+        for out in outs:
+            ids = out.split()
+            alternations.append(sum(1 for a, b in zip(ids, ids[1:]) if a != b))
+        print("  policy :"+policy+" | median :"+str(round(wall, 4))+" s | alternations :"+str(median(alternations)))
+
+
+if __name__ == "__main__":
+    switches("31-switch-many 100 10000", "31-switch-many 100 10000")
+    switches("31-switch-many-mn 100 10000 (1 worker)", "31-switch-many-mn 100 10000")
+    share("36-switch-fair 8", "36-switch-fair 8")
+    preemption("71-preemption 4", "71-preemption 4")
@@ -0,0 +1,102 @@
+import json
+import os
+import struct
+import subprocess
+import sys
+from collections import Counter
+
+# converts the scheduler traces written with THREAD_TRACE=path (see
+# thread_trace_config()) to the JSON trace event format of Chrome, to open in
+# chrome://tracing or https://ui.perfetto.dev: one line per worker, a slice
+# per thread run and a mark per event.
+# without arguments, traces 33-switch-many-cascade in 1:N and M:N mode.
+types = ["create", "switch", "yield", "block", "wake", "exit", "mutex_wait", "mutex_handoff"]
+event_format = "<QQQI4x"
+event_size = struct.calcsize(event_format)
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"THRTRACE":
+        raise ValueError(path+": not a trace")
+    version, nr, ticks_per_ns, tsc0 = struct.unpack_from("<IIdQ", data, 8)
+    if version != 1:
+        raise ValueError(path+": unknown version "+str(version))
+    offset = 8 + struct.calcsize("<IIdQ")
+    rings = []
+    for _ in range(nr):
+        worker, head, n = struct.unpack_from("<IQQ", data, offset)
+        offset += struct.calcsize("<IQQ")
+        events = [struct.unpack_from(event_format, data, offset + i * event_size) for i in range(n)]
+        offset += n * event_size
+        rings.append((worker, head, events))
+    return ticks_per_ns, tsc0, rings
+
+
+def to_chrome(ticks_per_ns, tsc0, rings):
+    names = {}
+    created = Counter()
+
+    # a struct thread is reused by later threads: each creation gets a new name
+    def name(addr, create=False):
+        if create or addr not in names:
+            created[addr] += 1
+            names[addr] = hex(addr) + ("" if created[addr] == 1 else "#"+str(created[addr]))
+        return names[addr]
+
+    def us(tsc):
+        return (tsc - tsc0) / ticks_per_ns / 1000.0
+
+    # the names follow the creations in time order, across the workers
+    timeline = sorted((e[0], worker, e) for worker, _, events in rings for e in events)
+    out = []
+    running = {}
+    for worker, head, events in rings:
+        out.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": worker,
+                    "args": {"name": "worker "+str(worker)+" ("+str(head)+" events)"}})
+    for tsc, worker, (_, thread, arg, kind) in timeline:
+        kind_name = types[kind] if kind < len(types) else str(kind)
+        if kind_name == "switch":
+            if worker in running:
+                start, th = running[worker]
+                out.append({"name": th, "cat": "run", "ph": "X", "pid": 1, "tid": worker,
+                            "ts": start, "dur": us(tsc) - start})
+            running[worker] = (us(tsc), name(thread))
+            continue
+        args = {"thread": name(thread, kind_name == "create")}
+        if kind_name in ("create", "wake", "yield") and arg:
+            args["by" if kind_name != "yield" else "to"] = name(arg)
+        elif arg:
+            args["object"] = hex(arg)
+        out.append({"name": kind_name, "cat": "sched", "ph": "i", "s": "t", "pid": 1, "tid": worker,
+                    "ts": us(tsc), "args": args})
+    last = us(timeline[-1][0]) if timeline else 0
+    for worker, (start, th) in running.items():
+        out.append({"name": th, "cat": "run", "ph": "X", "pid": 1, "tid": worker, "ts": start, "dur": last - start})
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def convert(dump, json_path):
+    ticks_per_ns, tsc0, rings = read_dump(dump)
+    with open(json_path, "w") as f:
+        json.dump(to_chrome(ticks_per_ns, tsc0, rings), f)
+    counts = Counter(types[e[3]] for _, _, events in rings for e in events)
+    print(dump+" -> "+json_path+" | "+str(len(rings))+" workers | "
+          + " ".join(k+":"+str(counts[k]) for k in types if counts[k]))
+
+
+def trace(cmd, dump, workers=None):
+    env = dict(os.environ, THREAD_TRACE=dump)
+    if workers is not None:
+        env["THREAD_WORKERS"] = str(workers)
+    subprocess.run("./"+cmd, shell=True, env=env, capture_output=True, check=True)
+    convert(dump, os.path.splitext(dump)[0]+".json")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1:
+        convert(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else os.path.splitext(sys.argv[1])[0]+".json")
+    else:
+        trace("33-switch-many-cascade 20 5", "trace-33-switch-many-cascade.bin")
+        trace("33-switch-many-cascade-mn 20 5", "trace-33-switch-many-cascade-mn.bin", workers=4)
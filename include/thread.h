@@ -3,6 +3,13 @@
 
 #ifndef USE_PTHREAD
 
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
 /* identifiant de thread
  * NB: pourra être un entier au lieu d'un pointeur si ca vous arrange,
  *     mais attention aux inconvénient des tableaux de threads
@@ -19,6 +26,55 @@ extern thread_t thread_self(void);
  */
 extern int thread_create(thread_t *newthread, void *(*func)(void *), void *funcarg);
 
+/* attributs de création d'un thread, à initialiser avec thread_attr_init():
+ * - taille de pile (au moins THREAD_STACK_MIN octets, arrondie à la page),
+ * - priorité initiale, entre THREAD_PRIO_MIN et THREAD_PRIO_MAX (voir thread_setpriority()),
+ * - état détaché (THREAD_CREATE_DETACHED) ou joignable (THREAD_CREATE_JOINABLE).
+ *   les ressources d'un thread détaché sont libérées dès qu'il se termine,
+ *   il ne peut pas être joint.
+ * toutes ces fonctions renvoient 0 en cas de succès, -1 en cas d'erreur.
+ */
+#define THREAD_STACK_MIN (8*1024)
+
+#define THREAD_PRIO_MIN    0
+#define THREAD_PRIO_NORMAL 16
+#define THREAD_PRIO_MAX    31
+
+#define THREAD_CREATE_JOINABLE 0
+#define THREAD_CREATE_DETACHED 1
+
+typedef struct thread_attr {
+    size_t stacksize;
+    int priority;
+    int detachstate;
+} thread_attr_t;
+
+extern int thread_attr_init(thread_attr_t *attr);
+extern int thread_attr_destroy(thread_attr_t *attr);
+extern int thread_attr_setstacksize(thread_attr_t *attr, size_t stacksize);
+extern int thread_attr_getstacksize(const thread_attr_t *attr, size_t *stacksize);
+extern int thread_attr_setpriority(thread_attr_t *attr, int priority);
+extern int thread_attr_getpriority(const thread_attr_t *attr, int *priority);
+extern int thread_attr_setdetachstate(thread_attr_t *attr, int detachstate);
+extern int thread_attr_getdetachstate(const thread_attr_t *attr, int *detachstate);
+
+/* changer ou lire la priorité d'un thread, entre THREAD_PRIO_MIN et THREAD_PRIO_MAX.
+ * un thread prêt de plus haute priorité passe toujours avant les autres, et
+ * thread_yield() ne cède pas la main à un thread de priorité inférieure.
+ * un thread qui en joint un autre lui transmet sa priorité si elle est plus haute.
+ * en M:N, la priorité ordonne les threads prêts de chaque kernel thread.
+ * renvoient 0 en cas de succès, -1 en cas d'erreur.
+ */
+extern int thread_setpriority(thread_t thread, int priority);
+extern int thread_getpriority(thread_t thread, int *priority);
+
+/* creer un nouveau thread avec les attributs attr, ou ceux par défaut si attr est NULL.
+ * seule la pile demandée est allouée.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+extern int thread_create_attr(thread_t *newthread, const thread_attr_t *attr,
+                              void *(*func)(void *), void *funcarg);
+
 /* passer la main à un autre thread.
  */
 extern int thread_yield(void);
@@ -29,6 +85,30 @@ extern int thread_yield(void);
  */
 extern int thread_join(thread_t thread, void **retval);
 
+/* attendre la fin d'exécution d'un thread au plus jusqu'à l'heure absolue
+ * abstime (CLOCK_REALTIME, comme pour pthread_timedjoin_np()).
+ * renvoie ETIMEDOUT si le thread ne s'est pas terminé avant: il peut alors
+ * être joint plus tard.
+ */
+extern int thread_timedjoin(thread_t thread, void **retval, const struct timespec *abstime);
+
+/* détacher un thread: sa pile et sa structure sont rendues au cache (ou
+ * libérées) dès qu'il se termine, sans attendre de thread_join(), ou tout de
+ * suite s'il est déjà terminé. il ne peut plus être joint ensuite.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur (thread déjà détaché ou
+ * en train d'être joint, thread principal).
+ */
+extern int thread_detach(thread_t thread);
+
+/* endormir le thread courant pendant ns nanosecondes, ou jusqu'à l'instant
+ * deadline_ns en nanosecondes de CLOCK_MONOTONIC (clock_gettime()), sans
+ * bloquer les autres threads. les threads endormis sont rangés dans une roue
+ * de temporisation hiérarchique, consultée quand plus aucun thread n'est prêt.
+ * renvoient 0.
+ */
+extern int thread_sleep_ns(uint64_t ns);
+extern int thread_sleep_until(uint64_t deadline_ns);
+
 /* terminer le thread courant en renvoyant la valeur de retour retval.
  * cette fonction ne retourne jamais.
  *
@@ -39,27 +119,419 @@ extern int thread_join(thread_t thread, void **retval);
  */
 extern void thread_exit(void *retval)__attribute__ ((__noreturn__));
 
-/* Interface possible pour les mutex */
+/* données propres à chaque thread, comme pthread_key_create() et consorts.
+ * chaque clé désigne une valeur par thread, NULL à sa création.
+ * thread_key_create() crée une clé dont le destructeur (s'il n'est pas NULL)
+ * est appelé avec la valeur non NULL de chaque thread qui se termine, après
+ * l'avoir remise à NULL; les destructeurs sont rappelés tant qu'ils redonnent
+ * des valeurs, au plus THREAD_DESTRUCTOR_ITERATIONS fois. une clé détruite
+ * n'appelle plus son destructeur et n'est pas réutilisée: au plus
+ * THREAD_KEYS_MAX clés peuvent être créées. les THREAD_KEYS_INLINE premières
+ * sont rangées dans la structure du thread.
+ * thread_key_create(), thread_key_delete() et thread_setspecific() renvoient 0
+ * en cas de succès, un code d'erreur sinon (EAGAIN, EINVAL ou ENOMEM).
+ * thread_getspecific() renvoie NULL pour une clé invalide.
+ */
+#define THREAD_KEYS_MAX 1024
+#define THREAD_KEYS_INLINE 8
+#define THREAD_DESTRUCTOR_ITERATIONS 4
+typedef unsigned int thread_key_t;
+extern int thread_key_create(thread_key_t *key, void (*destructor)(void *));
+extern int thread_key_delete(thread_key_t key);
+extern void *thread_getspecific(thread_key_t key);
+extern int thread_setspecific(thread_key_t key, const void *value);
+
+/* configurer le cache des threads terminés et joints (structure + pile),
+ * réutilisés par les thread_create() suivants au lieu d'être libérés.
+ * max: nombre maximal de threads gardés en cache (0 désactive le cache).
+ * prewarm: nombre de threads alloués immédiatement dans le cache.
+ * les valeurs au démarrage peuvent être données par les variables
+ * d'environnement THREAD_CACHE_MAX et THREAD_CACHE_PREWARM.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+extern int thread_cache_config(unsigned int max, unsigned int prewarm);
+
+/* configurer la préemption des threads (désactivée par défaut).
+ * un thread qui calcule depuis plus de quantum_us microsecondes de temps CPU
+ * est interrompu par le signal SIGVTALRM et passe la main comme avec thread_yield().
+ * seul le code du programme est préempté, jamais celui des bibliothèques
+ * (libc comprise) qu'il appelle. quantum_us = 0 désactive la préemption.
+ * la valeur au démarrage peut être donnée par la variable d'environnement
+ * THREAD_PREEMPT_US.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+extern int thread_preempt_config(unsigned int quantum_us);
+
+/* configurer l'attente d'un thread noyau qui n'a plus de thread à exécuter.
+ * il cherche un thread prêt pendant spin_us microsecondes avant de s'endormir
+ * dans le noyau (epoll_wait() ou futex) jusqu'à une échéance, un descripteur
+ * prêt ou un thread rendu prêt par un autre thread noyau. attendre en
+ * consommant du CPU réduit la latence des réveils, 0 (par défaut) s'endort
+ * aussitôt. la valeur au démarrage peut être donnée par la variable
+ * d'environnement THREAD_IDLE_SPIN_US.
+ * renvoie 0 en cas de succès.
+ */
+extern int thread_idle_config(unsigned int spin_us);
+
+/* configurer la politique d'ordonnancement:
+ * - THREAD_SCHED_FIFO (par défaut): les threads prêts passent par ordre de
+ *   priorité, puis dans leur ordre d'arrivée (voir thread_setpriority()).
+ * - THREAD_SCHED_FAIR: les threads se partagent le processeur au prorata de
+ *   leur poids, qui augmente de 25% par niveau de priorité. le prochain thread
+ *   est celui qui a consommé le moins de temps CPU pondéré, comme avec le CFS
+ *   de Linux, même si un thread plus prioritaire fait thread_yield().
+ * la politique ne peut plus changer une fois des threads prêts à s'exécuter
+ * (en M:N, une fois le premier thread créé). la valeur au démarrage peut être
+ * donnée par la variable d'environnement THREAD_SCHED ("fifo" ou "fair").
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+#define THREAD_SCHED_FIFO 0
+#define THREAD_SCHED_FAIR 1
+
+extern int thread_sched_config(int policy);
+
+/* configurer la détection des interblocages, toujours active.
+ * thread_join() et thread_mutex_lock() suivent la chaîne des attentes: le
+ * thread attendu, puis le thread qu'il attend lui-même (qu'il le joigne ou
+ * qu'il attende un mutex qu'il détient), etc., sur au plus 16 threads. si la
+ * chaîne revient au thread appelant, il ne se bloque pas: thread_join() renvoie
+ * -1 avec errno à EDEADLK, et thread_mutex_lock() renvoie EDEADLK. les attentes
+ * avec une échéance ne sont jamais des interblocages.
+ * hook, s'il n'est pas NULL, est alors appelé avec le cycle: cycle[0] est le
+ * thread appelant, chaque thread attend le suivant et le dernier attend cycle[0].
+ * si plus aucun thread ne peut s'exécuter alors que certains restent bloqués,
+ * le programme le signale sur la sortie d'erreur et se termine avec EXIT_FAILURE.
+ * renvoie 0.
+ */
+typedef void (*thread_deadlock_hook_t)(const thread_t *cycle, int len);
+
+extern int thread_deadlock_config(thread_deadlock_hook_t hook);
+
+/* configurer le traçage des événements de l'ordonnanceur (désactivé par défaut):
+ * créations, changements de contexte, yield, blocages, réveils, terminaisons
+ * et passages de mutex, datés par le compteur de cycles du processeur (TSC).
+ * chaque thread noyau garde ses derniers événements dans un tampon circulaire
+ * qu'il est seul à remplir, sans verrou. thread_trace_config(path) commence
+ * l'enregistrement, thread_trace_config(NULL) l'arrête et écrit les tampons
+ * dans le fichier path, comme à la fin du programme s'il n'est pas arrêté.
+ * l'enregistrement peut aussi être activé en lançant le programme avec la
+ * variable d'environnement THREAD_TRACE=path. graphs/trace_script.py convertit
+ * le fichier au format JSON des traces de Chrome (chrome://tracing, Perfetto).
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+extern int thread_trace_config(const char *path);
+
+/* configurer la mesure de l'usage des piles (désactivée par défaut).
+ * thread_stack_config(path) remplit la pile des threads créés ensuite d'un
+ * motif connu; quand l'un d'eux se termine, on cherche le mot le plus bas
+ * qui l'a perdu pour connaître l'usage maximal de sa pile, que l'on cumule
+ * par fonction de démarrage (max, moyenne et histogramme). remplir la pile
+ * la fait compter entièrement dans la mémoire du processus.
+ * thread_stack_config(NULL) arrête la mesure et écrit dans le fichier path
+ * une ligne pour l'ensemble des threads puis une par fonction, avec une
+ * taille de pile suggérée (hint=, l'usage maximal plus un quart, arrondi à
+ * la page), comme à la fin du programme si elle n'est pas arrêtée. la mesure
+ * peut aussi être activée avec la variable d'environnement THREAD_STACK_PROFILE=path.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+extern int thread_stack_config(const char *path);
+
+/* statistiques de l'ordonnanceur, tenues à chaque changement de contexte si
+ * la bibliothèque est compilée avec THREAD_STATS (option CMake, activée par
+ * défaut); sans elle, les compteurs n'existent pas et les fonctions renvoient -1.
+ * thread_stats() remplit les compteurs du thread depuis sa création, l'état
+ * en cours compris. les durées sont mesurées avec le compteur de cycles du
+ * processeur (TSC) et converties en nanosecondes à la lecture.
+ * thread_stats_global() remplit les compteurs de toute la bibliothèque, lus
+ * sans verrou: en M:N, ceux des autres threads noyau peuvent être en retard.
+ * renvoient 0 en cas de succès, -1 en cas d'erreur.
+ */
+typedef struct thread_stats {
+    uint64_t voluntary_switches;   // le thread a cédé le processeur (yield, blocage, fin)
+    uint64_t involuntary_switches; // le thread a été préempté
+    uint64_t mutex_contended;      // thread_mutex_lock() a trouvé le mutex verrouillé et attendu
+    uint64_t run_ns;               // temps passé à s'exécuter
+    uint64_t runnable_ns;          // temps passé prêt, à attendre un processeur
+    uint64_t blocked_ns;           // temps passé bloqué (join, mutex, sommeil, E/S...)
+} thread_stats_t;
+
+typedef struct thread_global_stats {
+    uint64_t threads;    // threads créés et pas encore terminés, main compris
+    uint64_t runnable;   // threads dans les files des threads prêts
+    uint64_t io_waiting; // threads bloqués dans une E/S, avec epoll ou io_uring
+    uint64_t switches;   // changements de contexte depuis le démarrage
+} thread_global_stats_t;
+
+extern int thread_stats(thread_t thread, thread_stats_t *stats);
+extern int thread_stats_global(thread_global_stats_t *stats);
+
+/* file des threads bloqués sur une primitive de synchronisation, manipulée
+ * par la bibliothèque avec les macros TAILQ (même disposition que TAILQ_HEAD).
+ */
+struct thread;
+typedef struct thread_waitq {
+    struct thread *tqh_first;
+    struct thread **tqh_last;
+    int lock; // verrou de la file entre les threads noyau en mode M:N
+} thread_waitq_t;
+
+/* Interface possible pour les mutex
+ * un thread qui trouve le mutex verrouillé attend dans waiters sans consommer
+ * de CPU; thread_mutex_unlock() donne directement le mutex au premier de la file.
+ */
 typedef struct thread_mutex { int dummy;
     int is_destroyed; // un indice de destruction du mutex
     thread_t locker; // adresse vers le thread qui a locker le thread
+    thread_waitq_t waiters; // threads en attente du mutex, dans l'ordre d'arrivée
 } thread_mutex_t;
 int thread_mutex_init(thread_mutex_t *mutex);
 int thread_mutex_destroy(thread_mutex_t *mutex);
 int thread_mutex_lock(thread_mutex_t *mutex);
 int thread_mutex_unlock(thread_mutex_t *mutex);
+/* comme thread_mutex_lock(), mais renvoie ETIMEDOUT si le mutex est encore
+ * verrouillé à l'heure absolue abstime (CLOCK_REALTIME).
+ */
+int thread_mutex_timedlock(thread_mutex_t *mutex, const struct timespec *abstime);
+
+/* Interface pour les variables de condition
+ * thread_cond_wait() déverrouille le mutex et bloque le thread dans waiters
+ * jusqu'à un thread_cond_signal() (le premier en attente est réveillé) ou un
+ * thread_cond_broadcast() (tous le sont); le mutex est reverrouillé au retour.
+ * thread_cond_timedwait() renvoie ETIMEDOUT si l'heure absolue abstime
+ * (CLOCK_REALTIME, comme pour pthread_cond_timedwait()) est dépassée avant.
+ * ces fonctions renvoient 0 en cas de succès.
+ */
+typedef struct thread_cond {
+    thread_waitq_t waiters; // threads en attente du signal, dans l'ordre d'arrivée
+} thread_cond_t;
+int thread_cond_init(thread_cond_t *cond);
+int thread_cond_destroy(thread_cond_t *cond);
+int thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex);
+int thread_cond_timedwait(thread_cond_t *cond, thread_mutex_t *mutex, const struct timespec *abstime);
+int thread_cond_signal(thread_cond_t *cond);
+int thread_cond_broadcast(thread_cond_t *cond);
+
+/* Interface pour les sémaphores
+ * thread_sem_wait() prend un jeton, ou bloque le thread dans waiters jusqu'à ce
+ * qu'un thread_sem_post() lui en donne un: le jeton passe directement au
+ * premier de la file, sans être rendu au compteur.
+ * thread_sem_trywait() ne bloque jamais et renvoie -1 (errno EAGAIN) s'il n'y a
+ * pas de jeton. ces fonctions renvoient 0 en cas de succès, -1 en cas d'erreur,
+ * comme les sem_*() de POSIX.
+ */
+typedef struct thread_sem {
+    unsigned int value; // nombre de jetons disponibles
+    thread_waitq_t waiters; // threads en attente d'un jeton, dans l'ordre d'arrivée
+} thread_sem_t;
+int thread_sem_init(thread_sem_t *sem, unsigned int value);
+int thread_sem_destroy(thread_sem_t *sem);
+int thread_sem_wait(thread_sem_t *sem);
+int thread_sem_trywait(thread_sem_t *sem);
+int thread_sem_post(thread_sem_t *sem);
+
+/* Interface pour les barrières
+ * thread_barrier_wait() bloque le thread jusqu'à ce que count threads aient
+ * atteint la barrière; elle renvoie alors THREAD_BARRIER_SERIAL_THREAD dans un
+ * seul d'entre eux (le dernier arrivé) et 0 dans les autres. la barrière est
+ * aussitôt réutilisable pour la phase suivante.
+ */
+#define THREAD_BARRIER_SERIAL_THREAD -1
+typedef struct thread_barrier {
+    unsigned int count; // nombre de threads à attendre
+    unsigned int arrived; // threads arrivés dans la phase en cours
+    thread_waitq_t waiters; // threads arrivés en attente des autres
+} thread_barrier_t;
+int thread_barrier_init(thread_barrier_t *barrier, unsigned int count);
+int thread_barrier_destroy(thread_barrier_t *barrier);
+int thread_barrier_wait(thread_barrier_t *barrier);
+
+/* Interface pour les verrous lecteurs/rédacteur
+ * plusieurs lecteurs (thread_rwlock_rdlock()) peuvent tenir le verrou ensemble,
+ * un rédacteur (thread_rwlock_wrlock()) le tient seul; thread_rwlock_unlock()
+ * libère l'un ou l'autre. les rédacteurs sont prioritaires: dès que l'un
+ * d'eux attend, les nouveaux lecteurs attendent aussi, et le verrou libéré
+ * passe au premier rédacteur en attente avant les lecteurs.
+ * les fonctions try* ne bloquent jamais. ces fonctions renvoient 0 en cas de succès.
+ */
+typedef struct thread_rwlock {
+    unsigned int state; // nombre de lecteurs, présence d'un rédacteur et d'attente
+    thread_waitq_t readers; // lecteurs en attente, son verrou protège aussi writers
+    thread_waitq_t writers; // rédacteurs en attente, servis en premier
+} thread_rwlock_t;
+int thread_rwlock_init(thread_rwlock_t *rwlock);
+int thread_rwlock_destroy(thread_rwlock_t *rwlock);
+int thread_rwlock_rdlock(thread_rwlock_t *rwlock);
+int thread_rwlock_wrlock(thread_rwlock_t *rwlock);
+int thread_rwlock_tryrdlock(thread_rwlock_t *rwlock);
+int thread_rwlock_trywrlock(thread_rwlock_t *rwlock);
+int thread_rwlock_unlock(thread_rwlock_t *rwlock);
+
+/* Interface pour les futures
+ * un future est une valeur calculée plus tard. thread_async() la calcule en
+ * appelant func(funcarg) dans un nouveau thread détaché, thread_future_create()
+ * crée un future rempli par thread_future_set() (une seule fois).
+ * thread_future_get() bloque le thread jusqu'à ce que le future soit prêt et
+ * renvoie sa valeur dans *value. thread_future_wait_any() bloque jusqu'à ce que
+ * l'un des n futures soit prêt et renvoie son indice, thread_future_wait_all()
+ * jusqu'à ce qu'ils le soient tous.
+ * thread_future_then() crée le future *next de valeur func(valeur de future),
+ * calculée sans créer de thread: par le thread qui remplit future, aussitôt
+ * après, ou tout de suite si future est déjà prêt. func doit donc être courte.
+ * un future se détruit une fois prêt, avec thread_future_destroy().
+ * ces fonctions renvoient 0 en cas de succès, -1 en cas d'erreur.
+ */
+typedef struct thread_future *thread_future_t;
+int thread_async(thread_future_t *future, void *(*func)(void *), void *funcarg);
+int thread_future_create(thread_future_t *future);
+int thread_future_set(thread_future_t future, void *value);
+int thread_future_get(thread_future_t future, void **value);
+int thread_future_wait_any(thread_future_t *futures, int n);
+int thread_future_wait_all(thread_future_t *futures, int n);
+int thread_future_then(thread_future_t *next, thread_future_t future, void *(*func)(void *));
+int thread_future_destroy(thread_future_t future);
+
+/* Interface pour les entrées/sorties
+ * mêmes arguments et valeurs de retour que read(), write(), accept(), connect()
+ * et poll(), mais quand l'opération bloquerait, seul le thread appelant est
+ * bloqué: il attend que le descripteur soit prêt sans consommer de CPU, et les
+ * autres threads continuent de s'exécuter.
+ * les sockets d'écoute et les sockets connectées par thread_connect() sont
+ * passées en mode non bloquant (O_NONBLOCK), sauf avec io_uring (voir plus bas).
+ * les descripteurs autres que des sockets ne le sont que le temps d'un appel:
+ * ils retrouvent leur mode ensuite, que partagent peut-être d'autres processus.
+ * thread_poll() accepte comme poll() les descripteurs négatifs, ignorés, et
+ * ceux qui apparaissent plusieurs fois.
+ */
+ssize_t thread_read(int fd, void *buf, size_t count);
+ssize_t thread_write(int fd, const void *buf, size_t count);
+int thread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
+int thread_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
+int thread_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+/* entrées/sorties sur fichiers, à une position donnée.
+ * avec io_uring (THREAD_IO_URING à la compilation, désactivable en lançant
+ * le programme avec THREAD_IO_URING=0), seul le thread appelant attend le
+ * disque: les requêtes des threads sont soumises au noyau par lots, à chaque
+ * changement de contexte. la lecture,
+ * l'écriture, accept() et connect() passent alors aussi par io_uring.
+ * sans io_uring, ces fonctions bloquent le thread noyau comme les appels système.
+ */
+ssize_t thread_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t thread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+int thread_fsync(int fd);
 
 #else /* USE_PTHREAD */
 
 /* Si on compile avec -DUSE_PTHREAD, ce sont les pthreads qui sont utilisés */
 #include <sched.h>
 #include <pthread.h>
+#include <limits.h>
+#include <semaphore.h>
 #define thread_t pthread_t
 #define thread_self pthread_self
 #define thread_create(th, func, arg) pthread_create(th, NULL, func, arg)
 #define thread_yield sched_yield
 #define thread_join pthread_join
+#define thread_timedjoin pthread_timedjoin_np
+#define thread_detach pthread_detach
 #define thread_exit pthread_exit
+#define THREAD_KEYS_MAX PTHREAD_KEYS_MAX
+#define THREAD_DESTRUCTOR_ITERATIONS PTHREAD_DESTRUCTOR_ITERATIONS
+#define thread_key_t pthread_key_t
+#define thread_key_create pthread_key_create
+#define thread_key_delete pthread_key_delete
+#define thread_getspecific pthread_getspecific
+#define thread_setspecific pthread_setspecific
+#define thread_cache_config(max, prewarm) 0
+#define thread_preempt_config(quantum_us) 0
+#define thread_idle_config(spin_us) 0
+#define THREAD_SCHED_FIFO 0
+#define THREAD_SCHED_FAIR 1
+#define thread_sched_config(policy) 0
+typedef void (*thread_deadlock_hook_t)(const thread_t *cycle, int len);
+static inline int thread_deadlock_config(thread_deadlock_hook_t hook) {
+    (void)hook;
+    return 0;
+}
+static inline int thread_trace_config(const char *path) {
+    (void)path;
+    return 0;
+}
+/* les piles des pthreads ne sont pas mesurées */
+static inline int thread_stack_config(const char *path) {
+    (void)path;
+    return -1;
+}
+/* le noyau ne donne pas ces compteurs par thread */
+#include <stdint.h>
+typedef struct thread_stats {
+    uint64_t voluntary_switches;
+    uint64_t involuntary_switches;
+    uint64_t mutex_contended;
+    uint64_t run_ns;
+    uint64_t runnable_ns;
+    uint64_t blocked_ns;
+} thread_stats_t;
+typedef struct thread_global_stats {
+    uint64_t threads;
+    uint64_t runnable;
+    uint64_t io_waiting;
+    uint64_t switches;
+} thread_global_stats_t;
+static inline int thread_stats(thread_t thread, thread_stats_t *stats) {
+    (void)thread;
+    (void)stats;
+    return -1;
+}
+static inline int thread_stats_global(thread_global_stats_t *stats) {
+    (void)stats;
+    return -1;
+}
+
+/* les pthreads dorment dans le noyau */
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+static inline int thread_sleep_until(uint64_t deadline_ns) {
+    struct timespec ts = { deadline_ns / 1000000000ULL, deadline_ns % 1000000000ULL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    return 0;
+}
+static inline int thread_sleep_ns(uint64_t ns) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return thread_sleep_until((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec + ns);
+}
+
+/* Attributs de threads */
+#define THREAD_STACK_MIN PTHREAD_STACK_MIN
+#define THREAD_PRIO_MIN    0
+#define THREAD_PRIO_NORMAL 16
+#define THREAD_PRIO_MAX    31
+#define THREAD_CREATE_JOINABLE PTHREAD_CREATE_JOINABLE
+#define THREAD_CREATE_DETACHED PTHREAD_CREATE_DETACHED
+#define thread_attr_t               pthread_attr_t
+#define thread_attr_init            pthread_attr_init
+#define thread_attr_destroy         pthread_attr_destroy
+#define thread_attr_setstacksize    pthread_attr_setstacksize
+#define thread_attr_getstacksize    pthread_attr_getstacksize
+#define thread_attr_setdetachstate  pthread_attr_setdetachstate
+#define thread_attr_getdetachstate  pthread_attr_getdetachstate
+/* la priorité n'a pas d'équivalent sous SCHED_OTHER, elle est ignorée */
+#define thread_attr_setpriority(attr, prio) ((void)(attr), (void)(prio), 0)
+#define thread_attr_getpriority(attr, prio) ((void)(attr), *(prio) = THREAD_PRIO_NORMAL, 0)
+#define thread_create_attr          pthread_create
+static inline int thread_setpriority(pthread_t th, int prio) {
+    (void)th;
+    (void)prio;
+    return 0;
+}
+static inline int thread_getpriority(pthread_t th, int *prio) {
+    (void)th;
+    *prio = THREAD_PRIO_NORMAL;
+    return 0;
+}
 
 /* Interface possible pour les mutex */
 #define thread_mutex_t            pthread_mutex_t
@@ -67,6 +539,232 @@ int thread_mutex_unlock(thread_mutex_t *mutex);
 #define thread_mutex_destroy      pthread_mutex_destroy
 #define thread_mutex_lock         pthread_mutex_lock
 #define thread_mutex_unlock       pthread_mutex_unlock
+#define thread_mutex_timedlock    pthread_mutex_timedlock
+
+/* Interface pour les variables de condition */
+#define thread_cond_t             pthread_cond_t
+#define thread_cond_init(_cond)   pthread_cond_init(_cond, NULL)
+#define thread_cond_destroy       pthread_cond_destroy
+#define thread_cond_wait          pthread_cond_wait
+#define thread_cond_timedwait     pthread_cond_timedwait
+#define thread_cond_signal        pthread_cond_signal
+#define thread_cond_broadcast     pthread_cond_broadcast
+
+/* Interface pour les sémaphores */
+#define thread_sem_t                sem_t
+#define thread_sem_init(_sem, _val) sem_init(_sem, 0, _val)
+#define thread_sem_destroy          sem_destroy
+#define thread_sem_wait             sem_wait
+#define thread_sem_trywait          sem_trywait
+#define thread_sem_post             sem_post
+
+/* Interface pour les barrières */
+#define THREAD_BARRIER_SERIAL_THREAD PTHREAD_BARRIER_SERIAL_THREAD
+#define thread_barrier_t                  pthread_barrier_t
+#define thread_barrier_init(_bar, _count) pthread_barrier_init(_bar, NULL, _count)
+#define thread_barrier_destroy            pthread_barrier_destroy
+#define thread_barrier_wait               pthread_barrier_wait
+
+/* Interface pour les verrous lecteurs/rédacteur */
+#define thread_rwlock_t             pthread_rwlock_t
+#define thread_rwlock_init(_rwlock) pthread_rwlock_init(_rwlock, NULL)
+#define thread_rwlock_destroy       pthread_rwlock_destroy
+#define thread_rwlock_rdlock        pthread_rwlock_rdlock
+#define thread_rwlock_wrlock        pthread_rwlock_wrlock
+#define thread_rwlock_tryrdlock     pthread_rwlock_tryrdlock
+#define thread_rwlock_trywrlock     pthread_rwlock_trywrlock
+#define thread_rwlock_unlock        pthread_rwlock_unlock
+
+/* Interface pour les futures, chacun avec son verrou et sa condition: remplir
+ * un future ne réveille que les threads qui l'attendent. thread_future_wait_any()
+ * sur plusieurs futures s'inscrit auprès de chacun pour être réveillé par le
+ * premier prêt.
+ */
+#include <stdlib.h>
+struct thread_future_waiter {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int woken;
+};
+struct thread_future_node {
+    struct thread_future_waiter *waiter;
+    struct thread_future_node *next;
+};
+typedef struct thread_future {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int ready;
+    void *value;
+    void *(*func)(void *);
+    void *funcarg;
+    struct thread_future *conts, **conts_tail, *next_cont;
+    struct thread_future_node *waiters;
+} *thread_future_t;
+static inline int thread_future_create(thread_future_t *future) {
+    *future = calloc(1, sizeof(**future));
+    if (*future == NULL)
+        return -1;
+    pthread_mutex_init(&(*future)->mutex, NULL);
+    pthread_cond_init(&(*future)->cond, NULL);
+    (*future)->conts_tail = &(*future)->conts;
+    return 0;
+}
+static inline void thread_future_free(thread_future_t future) {
+    pthread_mutex_destroy(&future->mutex);
+    pthread_cond_destroy(&future->cond);
+    free(future);
+}
+static inline int thread_future_set(thread_future_t future, void *value) {
+    thread_future_t cont, next;
+    struct thread_future_node *node;
+    pthread_mutex_lock(&future->mutex);
+    if (future->ready) {
+        pthread_mutex_unlock(&future->mutex);
+        return -1;
+    }
+    future->value = value;
+    future->ready = 1;
+    cont = future->conts;
+    pthread_cond_broadcast(&future->cond);
+    for (node = future->waiters; node != NULL; node = node->next) {
+        pthread_mutex_lock(&node->waiter->mutex);
+        node->waiter->woken = 1;
+        pthread_cond_signal(&node->waiter->cond);
+        pthread_mutex_unlock(&node->waiter->mutex);
+    }
+    future->waiters = NULL;
+    pthread_mutex_unlock(&future->mutex);
+    for (; cont != NULL; cont = next) {
+        next = cont->next_cont;
+        thread_future_set(cont, cont->func(value));
+    }
+    return 0;
+}
+static inline void *thread_future_runner(void *arg) {
+    thread_future_t future = (thread_future_t)arg;
+    thread_future_set(future, future->func(future->funcarg));
+    return NULL;
+}
+static inline int thread_async(thread_future_t *future, void *(*func)(void *), void *funcarg) {
+    pthread_t th;
+    if (thread_future_create(future) != 0)
+        return -1;
+    (*future)->func = func;
+    (*future)->funcarg = funcarg;
+    if (pthread_create(&th, NULL, thread_future_runner, *future) != 0) {
+        thread_future_free(*future);
+        return -1;
+    }
+    pthread_detach(th);
+    return 0;
+}
+static inline int thread_future_ready(thread_future_t future) {
+    int ready;
+    pthread_mutex_lock(&future->mutex);
+    ready = future->ready;
+    pthread_mutex_unlock(&future->mutex);
+    return ready;
+}
+static inline int thread_future_wait_any(thread_future_t *futures, int n) {
+    struct thread_future_waiter waiter;
+    struct thread_future_node *nodes, **pnode;
+    int i, registered, found = -1;
+    if (n <= 0)
+        return -1;
+    if (n == 1) {
+        pthread_mutex_lock(&futures[0]->mutex);
+        while (!futures[0]->ready)
+            pthread_cond_wait(&futures[0]->cond, &futures[0]->mutex);
+        pthread_mutex_unlock(&futures[0]->mutex);
+        return 0;
+    }
+    nodes = malloc(n * sizeof(*nodes));
+    if (nodes == NULL)
+        return -1;
+    pthread_mutex_init(&waiter.mutex, NULL);
+    pthread_cond_init(&waiter.cond, NULL);
+    waiter.woken = 0;
+    for (registered = 0; registered < n; registered++) {
+        pthread_mutex_lock(&futures[registered]->mutex);
+        if (futures[registered]->ready) {
+            pthread_mutex_unlock(&futures[registered]->mutex);
+            found = registered;
+            break;
+        }
+        nodes[registered].waiter = &waiter;
+        nodes[registered].next = futures[registered]->waiters;
+        futures[registered]->waiters = &nodes[registered];
+        pthread_mutex_unlock(&futures[registered]->mutex);
+    }
+    if (found < 0) {
+        pthread_mutex_lock(&waiter.mutex);
+        while (!waiter.woken)
+            pthread_cond_wait(&waiter.cond, &waiter.mutex);
+        pthread_mutex_unlock(&waiter.mutex);
+    }
+    /* un future rempli a déjà vidé sa liste, les autres gardent le nœud */
+    for (i = 0; i < registered; i++) {
+        pthread_mutex_lock(&futures[i]->mutex);
+        for (pnode = &futures[i]->waiters; *pnode != NULL; pnode = &(*pnode)->next) {
+            if (*pnode == &nodes[i]) {
+                *pnode = nodes[i].next;
+                break;
+            }
+        }
+        if (found < 0 && futures[i]->ready)
+            found = i;
+        pthread_mutex_unlock(&futures[i]->mutex);
+    }
+    pthread_mutex_destroy(&waiter.mutex);
+    pthread_cond_destroy(&waiter.cond);
+    free(nodes);
+    return found;
+}
+static inline int thread_future_wait_all(thread_future_t *futures, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        thread_future_wait_any(&futures[i], 1);
+    return 0;
+}
+static inline int thread_future_get(thread_future_t future, void **value) {
+    thread_future_wait_any(&future, 1);
+    if (value)
+        *value = future->value;
+    return 0;
+}
+static inline int thread_future_then(thread_future_t *next, thread_future_t future, void *(*func)(void *)) {
+    if (thread_future_create(next) != 0)
+        return -1;
+    (*next)->func = func;
+    pthread_mutex_lock(&future->mutex);
+    if (!future->ready) {
+        *future->conts_tail = *next;
+        future->conts_tail = &(*next)->next_cont;
+        pthread_mutex_unlock(&future->mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&future->mutex);
+    return thread_future_set(*next, func(future->value));
+}
+static inline int thread_future_destroy(thread_future_t future) {
+    if (!thread_future_ready(future))
+        return -1;
+    thread_future_free(future);
+    return 0;
+}
+
+/* Interface pour les entrées/sorties */
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#define thread_read    read
+#define thread_write   write
+#define thread_accept  accept
+#define thread_connect connect
+#define thread_poll    poll
+#define thread_pread   pread
+#define thread_pwrite  pwrite
+#define thread_fsync   fsync
 
 #endif /* USE_PTHREAD */
 
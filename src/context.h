@@ -0,0 +1,134 @@
+#ifndef __CONTEXT_H__
+#define __CONTEXT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Execution contexts used by the scheduler to switch between threads.
+ *
+ * Two backends are available, selected at build time:
+ * - THREAD_ASM_SWITCH: hand-written switch (src/context.S) that only saves the
+ *   callee-saved registers, the stack pointer and the FP control state. It
+ *   never enters the kernel.
+ * - default: glibc ucontext (getcontext/makecontext/swapcontext), which also
+ *   saves and restores the signal mask with a rt_sigprocmask syscall.
+ */
+
+#ifdef THREAD_ASM_SWITCH
+
+typedef struct context {
+    void *sp; // saved stack pointer, the registers live on the stack
+} context_t;
+
+// implemented in context.S
+extern void ctx_switch(context_t *from, context_t *to);
+extern void ctx_trampoline(void);
+
+/**
+ * initializes the context of a thread that already runs on its own stack
+ * (the main thread): it will be filled by the first switch away from it.
+ */
+static inline void ctx_init(context_t *ctx) {
+    ctx->sp = NULL;
+}
+
+/**
+ * builds the initial frame of a new context so that the first switch to it
+ * enters entry() on top of the given stack.
+ */
+static inline void ctx_make(context_t *ctx, void *stack, size_t size, void (*entry)(void)) {
+    // the stack top must be 16 bytes aligned for the calls made by the trampoline
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+    /* frame popped by ctx_switch, from low to high addresses:
+     * mxcsr | x87 cw, r15, r14, r13, r12, rbx, rbp, return address
+     * the return address sits right below the top so that the trampoline
+     * starts with an aligned stack, as after a call.
+     */
+    uint64_t *frame = (uint64_t *)(top - 8 * sizeof(uint64_t));
+    uint32_t mxcsr;
+    uint16_t fpucw;
+
+    // a new context inherits the FP control state of its creator
+    __asm__ volatile("stmxcsr %0" : "=m"(mxcsr));
+    __asm__ volatile("fnstcw %0" : "=m"(fpucw));
+
+    frame[0] = (uint64_t)mxcsr | ((uint64_t)fpucw << 32);
+    frame[1] = 0;                    // r15
+    frame[2] = 0;                    // r14
+    frame[3] = 0;                    // r13
+    frame[4] = (uint64_t)entry;      // r12, called by the trampoline
+    frame[5] = 0;                    // rbx
+    frame[6] = 0;                    // rbp, ends the frame chain for debuggers
+    frame[7] = (uint64_t)ctx_trampoline;
+#elif defined(__aarch64__)
+    /* frame popped by ctx_switch, from low to high addresses:
+     * x19..x28, x29 (fp), x30 (lr), d8..d15, fpcr, padding
+     */
+    uint64_t *frame = (uint64_t *)(top - 22 * sizeof(uint64_t));
+    uint64_t fpcr;
+    int i;
+
+    // a new context inherits the FP control state of its creator
+    __asm__ volatile("mrs %0, fpcr" : "=r"(fpcr));
+
+    for (i = 0; i < 22; i++)
+        frame[i] = 0;
+    frame[0] = (uint64_t)entry;          // x19, called by the trampoline
+    frame[11] = (uint64_t)ctx_trampoline; // x30, where ctx_switch returns
+    frame[20] = fpcr;
+#else
+#error "THREAD_ASM_SWITCH is only available on x86-64 and AArch64"
+#endif
+
+    ctx->sp = frame;
+}
+
+/**
+ * saves the current context in from and resumes to.
+ */
+static inline void ctx_swap(context_t *from, context_t *to) {
+    ctx_switch(from, to);
+}
+
+/**
+ * resumes to without saving the current context.
+ */
+static inline void ctx_set(context_t *to) {
+    context_t dummy;
+    ctx_switch(&dummy, to);
+}
+
+#else /* THREAD_ASM_SWITCH */
+
+#include <ucontext.h>
+
+typedef struct context {
+    ucontext_t uctx;
+} context_t;
+
+static inline void ctx_init(context_t *ctx) {
+    getcontext(&ctx->uctx);
+}
+
+static inline void ctx_make(context_t *ctx, void *stack, size_t size, void (*entry)(void)) {
+    getcontext(&ctx->uctx);
+    ctx->uctx.uc_link = NULL;
+    ctx->uctx.uc_stack.ss_sp = stack;
+    ctx->uctx.uc_stack.ss_size = size;
+    makecontext(&ctx->uctx, entry, 0);
+}
+
+static inline void ctx_swap(context_t *from, context_t *to) {
+    swapcontext(&from->uctx, &to->uctx);
+}
+
+static inline void ctx_set(context_t *to) {
+    setcontext(&to->uctx);
+}
+
+#endif /* THREAD_ASM_SWITCH */
+
+#endif /* __CONTEXT_H__ */
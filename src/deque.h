@@ -0,0 +1,161 @@
+#ifndef __DEQUE_H__
+#define __DEQUE_H__
+
+#include <stdlib.h>
+
+/*
+ * Chase-Lev work-stealing deque of pointers.
+ *
+ * The owner pushes and takes at the bottom (LIFO) without any atomic
+ * read-modify-write in the common case; any other kernel thread can steal at
+ * the top (FIFO) with a single compare-and-swap. The owner may also steal from
+ * its own deque to get the oldest element.
+ *
+ * Memory orderings follow "Correct and Efficient Work-Stealing for Weak Memory
+ * Models" (Lê, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+ *
+ * The array grows when full. Thieves may still read the old array, so it is
+ * kept on a list and only freed by deque_destroy().
+ */
+
+#define DEQUE_INIT_SIZE 256
+
+// returned by deque_steal() when it lost a race and should be retried
+#define DEQUE_ABORT ((void *)1)
+
+struct deque_array {
+    long size;                 // number of slots, a power of two
+    struct deque_array *prev;  // older (smaller) array, freed with the deque
+    void *buf[];
+};
+
+struct deque {
+    long top;
+    long bottom;
+    struct deque_array *array;
+};
+
+static inline struct deque_array *deque_array_new(long size, struct deque_array *prev) {
+    struct deque_array *a = malloc(sizeof(struct deque_array) + size * sizeof(void *));
+    if (a != NULL) {
+        a->size = size;
+        a->prev = prev;
+    }
+    return a;
+}
+
+/**
+ * initializes an empty deque. returns 0 on success, -1 on failure.
+ */
+static inline int deque_init(struct deque *d) {
+    d->top = 0;
+    d->bottom = 0;
+    d->array = deque_array_new(DEQUE_INIT_SIZE, NULL);
+    return d->array != NULL ? 0 : -1;
+}
+
+/**
+ * frees the arrays of a deque, no other thread may use it anymore.
+ */
+static inline void deque_destroy(struct deque *d) {
+    struct deque_array *a = d->array;
+
+    while (a != NULL) {
+        struct deque_array *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    d->array = NULL;
+}
+
+/**
+ * returns 1 if the deque looks empty, racy by nature.
+ */
+static inline int deque_empty(struct deque *d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_SEQ_CST);
+    return b <= t;
+}
+
+/**
+ * doubles the array of the deque, copying the elements between t and b.
+ * only called by the owner.
+ */
+static inline struct deque_array *deque_grow(struct deque *d, struct deque_array *a, long t, long b) {
+    struct deque_array *na = deque_array_new(a->size * 2, a);
+    long i;
+
+    if (na == NULL)
+        abort();
+    for (i = t; i < b; i++)
+        na->buf[i & (na->size - 1)] = __atomic_load_n(&a->buf[i & (a->size - 1)], __ATOMIC_RELAXED);
+    __atomic_store_n(&d->array, na, __ATOMIC_RELEASE);
+
+    return na;
+}
+
+/**
+ * pushes x at the bottom of the deque. only called by the owner.
+ */
+static inline void deque_push(struct deque *d, void *x) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    struct deque_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+
+    if (b - t > a->size - 1)
+        a = deque_grow(d, a, t, b);
+    __atomic_store_n(&a->buf[b & (a->size - 1)], x, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * takes the element at the bottom of the deque, NULL if empty.
+ * only called by the owner.
+ */
+static inline void *deque_take(struct deque *d) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    struct deque_array *a = __atomic_load_n(&d->array, __ATOMIC_RELAXED);
+    long t;
+    void *x = NULL;
+
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (t <= b) {
+        x = __atomic_load_n(&a->buf[b & (a->size - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            // last element: race against the thieves for it
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                x = NULL;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return x;
+}
+
+/**
+ * steals the element at the top of the deque.
+ * returns NULL if empty, DEQUE_ABORT if another thread won the race.
+ */
+static inline void *deque_steal(struct deque *d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+
+    if (t < b) {
+        struct deque_array *a = __atomic_load_n(&d->array, __ATOMIC_ACQUIRE);
+        void *x = __atomic_load_n(&a->buf[t & (a->size - 1)], __ATOMIC_RELAXED);
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            return DEQUE_ABORT;
+        return x;
+    }
+
+    return NULL;
+}
+
+#endif /* __DEQUE_H__ */
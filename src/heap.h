@@ -0,0 +1,137 @@
+#ifndef __HEAP_H__
+#define __HEAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Intrusive pairing heap, smallest key first.
+ *
+ * The nodes are embedded in the elements, so the heap never allocates.
+ * Insertion is O(1), removal of the minimum or of any node O(log n) amortized
+ * ("The Pairing Heap: A New Form of Self-Adjusting Heap", Fredman, Sedgewick,
+ * Sleator, Tarjan, Algorithmica 1986). Nothing here is thread-safe.
+ */
+
+struct heap_node {
+    uint64_t key;
+    struct heap_node *child; // first child
+    struct heap_node *next;  // next sibling
+    struct heap_node *prev;  // previous sibling, or parent of a first child
+};
+
+struct heap {
+    struct heap_node *root;
+    unsigned int count;
+};
+
+static inline void heap_init(struct heap *h) {
+    h->root = NULL;
+    h->count = 0;
+}
+
+/**
+ * links two detached trees, the root with the larger key becoming the first
+ * child of the other one. returns the root of the result.
+ */
+static inline struct heap_node *heap_link(struct heap_node *a, struct heap_node *b) {
+    struct heap_node *tmp;
+
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (b->key < a->key) {
+        tmp = a;
+        a = b;
+        b = tmp;
+    }
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL)
+        a->child->prev = b;
+    a->child = b;
+
+    return a;
+}
+
+/**
+ * links a list of sibling trees into one, in two passes: pairs from left to
+ * right, then the pairs from right to left. returns the root of the result.
+ */
+static inline struct heap_node *heap_merge_pairs(struct heap_node *first) {
+    struct heap_node *pairs = NULL, *root = NULL, *a, *b;
+
+    while (first != NULL) {
+        a = first;
+        b = a->next;
+        first = b != NULL ? b->next : NULL;
+        a->next = a->prev = NULL;
+        if (b != NULL)
+            b->next = b->prev = NULL;
+        a = heap_link(a, b);
+        // stacked through next, in reverse order
+        a->next = pairs;
+        pairs = a;
+    }
+
+    while (pairs != NULL) {
+        a = pairs;
+        pairs = a->next;
+        a->next = NULL;
+        root = heap_link(root, a);
+    }
+
+    return root;
+}
+
+/**
+ * returns the node with the smallest key, NULL if the heap is empty.
+ */
+static inline struct heap_node *heap_min(struct heap *h) {
+    return h->root;
+}
+
+/**
+ * inserts a node, its key set.
+ */
+static inline void heap_insert(struct heap *h, struct heap_node *n) {
+    n->child = n->next = n->prev = NULL;
+    h->root = heap_link(h->root, n);
+    h->count++;
+}
+
+/**
+ * removes and returns the node with the smallest key, NULL if the heap is empty.
+ */
+static inline struct heap_node *heap_pop(struct heap *h) {
+    struct heap_node *n = h->root;
+
+    if (n != NULL) {
+        h->root = heap_merge_pairs(n->child);
+        h->count--;
+    }
+    return n;
+}
+
+/**
+ * removes a node from the heap it is in.
+ */
+static inline void heap_remove(struct heap *h, struct heap_node *n) {
+    if (n == h->root) {
+        heap_pop(h);
+        return;
+    }
+
+    // unlink the subtree of n from its siblings, then link its children back
+    if (n->prev->child == n)
+        n->prev->child = n->next;
+    else
+        n->prev->next = n->next;
+    if (n->next != NULL)
+        n->next->prev = n->prev;
+    h->root = heap_link(h->root, heap_merge_pairs(n->child));
+    h->count--;
+}
+
+#endif /* __HEAP_H__ */
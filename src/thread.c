@@ -1,19 +1,128 @@
-#include <ucontext.h>
+#define _GNU_SOURCE // gettid(), dl_iterate_phdr() and REG_RIP
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <link.h>
+#include <ucontext.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#ifdef THREAD_MN
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "thread.h"
 #include "queue.h"
+#include "context.h"
+#include "heap.h"
+#ifdef THREAD_MN
+#include "deque.h"
+#endif
+#ifdef THREAD_IO_URING
+#include "uring.h"
+#endif
 #include <valgrind/valgrind.h>
 
 #define STACK_SIZE 64*1024
+// number of PROT_NONE guard pages below each stack
+#define STACK_GUARD_PAGES 1
+// default high-water mark of the thread cache, see thread_cache_config()
+#ifndef THREAD_CACHE_MAX
+#define THREAD_CACHE_MAX 1024
+#endif
+// default number of cache entries allocated at startup
+#ifndef THREAD_CACHE_PREWARM
+#define THREAD_CACHE_PREWARM 0
+#endif
+// signal sent by the timers of the workers to preempt the running thread
+#define PREEMPT_SIGNAL SIGVTALRM
+// default time slice in microseconds, 0 disables preemption, see thread_preempt_config()
+#ifndef THREAD_PREEMPT_US
+#define THREAD_PREEMPT_US 0
+#endif
+// number of run queue pops between two checks for I/O readiness while threads are runnable
+#define IO_POLL_PERIOD 64
+// default time in microseconds an idle worker spins before blocking, see thread_idle_config()
+#ifndef THREAD_IDLE_SPIN_US
+#define THREAD_IDLE_SPIN_US 0
+#endif
+// number of spins of an idle worker between two looks at the clock, timers and descriptors
+#define IDLE_SPIN_CHECK 64
+// number of priority levels, one FIFO each in the run queue, indexed by a 32-bit mask
+#define NR_PRIO (THREAD_PRIO_MAX + 1)
+// default scheduling policy, see thread_sched_config()
+#ifndef THREAD_SCHED
+#define THREAD_SCHED THREAD_SCHED_FIFO
+#endif
+// virtual runtime in ns a thread that slept may lag behind the others in the fair policy
+#define FAIR_SLEEP_CREDIT_NS 1000000
+
+// threads followed along a chain of waits before giving up, see deadlock_check()
+#define DEADLOCK_CHAIN_MAX 16
+
+// events kept in the trace ring of each worker, a power of 2
+#ifndef THREAD_TRACE_EVENTS
+#define THREAD_TRACE_EVENTS (1 << 16)
+#endif
+// word the stacks are painted with while their usage is measured, see stack_paint()
+#define STACK_CANARY 0x5354414b43414e59ULL
+// entry functions whose stack usage is kept apart, a power of 2, the others are merged
+#define STACK_PROFILE_FUNCS 256
+// bucket b of the histograms counts the threads that used less than 1 KiB << b
+#define STACK_HIST_BUCKETS 12
+// the waits are published before the chain is followed, see deadlock_check()
+#ifdef THREAD_MN
+#define DEADLOCK_ORDER __ATOMIC_SEQ_CST
+#else
+#define DEADLOCK_ORDER __ATOMIC_RELAXED
+#endif
+// number of epoll events handled per call to epoll_wait()
+#define IO_EVENTS 64
+// the descriptors are tracked in chunks of IO_FD_CHUNK, up to IO_FD_CHUNK * IO_FD_CHUNKS
+#define IO_FD_CHUNK 1024
+#define IO_FD_CHUNKS 1024
+// sizes of the submission and completion queues of the io_uring ring
+#define IO_RING_ENTRIES 256
+#define IO_RING_CQ_ENTRIES 4096
+// the timer wheel has TIMER_LEVELS levels of TIMER_SLOTS slots, a slot of level 0
+// lasts a tick of 2^TIMER_TICK_SHIFT ns (65.5 us) and one of level n covers the
+// whole level n-1: the wheel spans 2^52 ns, about 52 days
+#define TIMER_TICK_SHIFT 16
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 6
+// not defined by older C libraries
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 #define JOINABLE (1U << 0)
 #define MAIN (1U << 1)
+#define DETACHED (1U << 2)
+#define QUEUED (1U << 3)
+#define IDLE (1U << 4)
+#define PAINTED (1U << 5)
 
+// value of master once the thread exited, see thread_join()
+#define EXITED_MASTER ((struct thread *)1)
+// value of master once the thread was detached by thread_detach(), until it exits
+#define DETACHED_MASTER ((struct thread *)2)
+
+// only the runnable threads wait in the run queue, the blocked ones are made
+// runnable again by thread_wake()
 typedef enum {
-  LOW,
-  NORMAL,
-  HIGH
-} priority;
+  BLOCKED,
+  RUNNABLE
+} thread_state;
 
 struct thread {
     void *(*func)(void *);
@@ -21,334 +130,4507 @@ struct thread {
     void *retval;
     unsigned int flags;
     int valgrind_stackid;
-    ucontext_t uctx;
-    priority p;
-    struct thread *master;
+    void *stack;
+    size_t stack_size;
+    context_t ctx;
+    thread_state state;
+    int prio;              // priority level, between THREAD_PRIO_MIN and THREAD_PRIO_MAX
+    struct thread *master; // thread blocked in joining this one, EXITED_MASTER after exit, DETACHED_MASTER once detached
+    int preempt_off;       // preemption is disabled while > 0, see preempt_disable()
+    int preempt_pending;   // the time slice ended while preemption was disabled
+    thread_waitq_t *waitq; // wait queue the thread is blocked in, if it has a deadline
+    uint64_t deadline;     // CLOCK_MONOTONIC time in ns at which the wait times out, 0 for none
+    int timed_out;         // set if the last wait timed out
+    uint32_t io_events;    // epoll events waited for while blocked on a descriptor
+    struct timer_slot *timer_slot; // slot of the timer wheel the thread waits in, if it has a deadline
+    TAILQ_ENTRY(thread) timeouts;  // link in that slot
+    thread_waitq_t joiners; // thread blocked in joining this one, see thread_join()
+    struct thread *wait_join;   // thread it joins without deadline, see deadlock_check()
+    thread_mutex_t *wait_mutex; // mutex it waits for without deadline
+    uint64_t vruntime;     // CPU time in ns weighted by the priority, orders the threads in the fair policy
+    uint64_t run_start;    // clock_ns() when the thread got the worker or was last charged, see fair_charge()
+    struct heap_node fair_node; // node in the fair run queue of a worker
+    void *specific[THREAD_KEYS_INLINE]; // values of the first keys, see thread_getspecific()
+    void **specific_ext;                // values of the other keys, NULL until one is set
+    unsigned int specific_ext_size;     // number of values in specific_ext
+#ifdef THREAD_STATS
+    struct thread_stats stats; // counters of thread_stats(), the durations in trace_clock() ticks
+    uint64_t stats_since;      // trace_clock() when the thread last started or stopped running, or was woken up
+    int stats_preempted;       // set while the thread yields because its time slice ended
+#endif
+#ifdef THREAD_MN
+    struct worker *fair_worker; // worker whose fair run queue the thread waits in, NULL if none
+    int on_cpu; // set while a worker runs the thread or has not finished switching away from it
+    int queued; // set while the thread waits in a deque, cleared by the worker that claims it
+#endif
     TAILQ_ENTRY(thread) threads;
 };
 
-// init FIFO for normal priority runnable threads
+/* a worker runs the threads on one kernel thread.
+ * there is a single worker in the default 1:N mode, and one per kernel thread
+ * of the pool in M:N mode (THREAD_MN).
+ */
+struct worker {
+    struct thread *current; // thread running on this worker
+    struct thread *prev;    // thread switched away from, finished by switch_finish()
+    int requeue;            // set if prev is still runnable and goes back to the run queue
+    unsigned long nr_switches;  // number of switches, to tell if a thread used a whole time slice
+    unsigned long tick_switches; // nr_switches at the previous tick of the timer
+    timer_t timer;          // CPU time timer of the kernel thread, sends PREEMPT_SIGNAL
+    int has_timer;
+    unsigned int io_ticks;  // run queue pops since the last check for I/O readiness
+    // LIFO of cached threads; joined threads whose struct and stack can be reused
+    TAILQ_HEAD(cached_lifo, thread) cached_hd;
+    unsigned int cached_count;
+    struct heap fair_runq;  // runnable threads by virtual runtime, in the fair policy
+    uint64_t min_vruntime;  // virtual runtime of the last thread taken from fair_runq, never decreases
+    struct trace_ring *trace; // last scheduler events, NULL until tracing is enabled
+#ifdef THREAD_MN
+    int fair_lock;          // protects fair_runq, which the other workers steal from
+    struct deque runq[NR_PRIO]; // runnable threads of each priority, stolen by the other workers when idle
+    uint32_t runq_mask;     // bit p set if runq[p] may not be empty, see runq_top()
+    unsigned int seed;      // state of the random choice of victims
+    struct thread idle_th;  // runs when no thread is runnable
+    pthread_t tid;
+#endif
+};
+
+/* the runnable FIFOs are used in 1:N mode, in M:N mode each worker has its own
+ * work-stealing deque instead.
+ */
+
+// FIFOs of runnable threads, one per priority level, initialized by init_thread()
 typedef TAILQ_HEAD(runnable_fifo, thread) runnable_hd_t;
-runnable_hd_t runnable_hd = TAILQ_HEAD_INITIALIZER(runnable_hd);
+runnable_hd_t runnable_hd[NR_PRIO];
 
-// init FIFO for high priority runnable threads
-typedef TAILQ_HEAD(high_prio_fifo, thread) high_prio_hd_t;
-high_prio_hd_t high_prio_hd = TAILQ_HEAD_INITIALIZER(high_prio_hd);
+// bit p set if runnable_hd[p] is not empty, to find the highest level in one instruction
+uint32_t runnable_mask;
+
+/**
+ * returns the highest priority level set in a non-empty mask of levels.
+ */
+static inline int prio_top(uint32_t mask) {
+    return 31 - __builtin_clz(mask);
+}
 
-// init FIFO for abandoned threads; threads who exited but never got joined
+// init FIFO for abandoned threads; threads who exited but never got joined.
+// only kept in 1:N mode, in M:N mode they are left to the system at exit
+// rather than serializing every exit and join on a shared list
 typedef TAILQ_HEAD(abandoned_fifo, thread) abandoned_hd_t;
 abandoned_hd_t abandoned_hd = TAILQ_HEAD_INITIALIZER(abandoned_hd);
 
+// maximum number of threads kept in the cache of each worker
+unsigned int cached_max = THREAD_CACHE_MAX;
+
+// size of a memory page, stacks and guards are multiples of it
+size_t page_size;
+// size of the stacks of threads created without an explicit stack size
+size_t default_stack_size;
+
 // main thread
 struct thread main_th;
-// current thread
-struct thread *current_th;
+
+// time slice of the threads in microseconds, 0 if preemption is disabled
+unsigned int preempt_quantum = 0;
+// time in ns an idle worker spins before blocking in the kernel
+uint64_t idle_spin_ns = 0;
+// THREAD_SCHED_FIFO or THREAD_SCHED_FAIR, see thread_sched_config()
+int sched_policy = THREAD_SCHED_FIFO;
+// number of keys created, they are never reused, see thread_key_create()
+unsigned int nr_keys = 0;
+// destructor of each key, NULL once it is deleted
+static void (*key_destructors[THREAD_KEYS_MAX])(void *);
+// set once the key is deleted
+static unsigned char key_deleted[THREAD_KEYS_MAX];
+// called with the cycle when a deadlock is detected, see thread_deadlock_config()
+thread_deadlock_hook_t deadlock_hook = NULL;
+
+// threads created and not exited yet, main included, see deadlock_exit()
+unsigned long nr_threads = 1;
+// weight of each priority level in the fair policy, 25% more CPU time per level
+static const uint32_t prio_weight[NR_PRIO] = {
+    29, 36, 45, 56, 70, 88, 110, 137, 172, 215, 268, 336, 419, 524, 655, 819,
+    1024, 1280, 1600, 2000, 2500, 3125, 3906, 4883, 6104, 7629, 9537, 11921, 14901, 18626, 23283, 29104
+};
+// address range of the code of the program, the only code that gets preempted
+uintptr_t text_start, text_end;
+
+TAILQ_HEAD(timer_slot, thread);
+
+/* hierarchical timer wheel of the threads blocked with a deadline, linked by
+ * their timeouts entry. a deadline in the same block of TIMER_SLOTS^(n+1) ticks
+ * as the current tick, but not in the same block of TIMER_SLOTS^n, waits in the
+ * level n slot it falls in. the slots of a level are cascaded down the wheel
+ * when the current tick enters them, so that the deadlines expire from level 0.
+ * inserting and cancelling are O(1), expiring is O(1) per tick.
+ */
+struct timer_wheel {
+    int lock;
+    unsigned int count; // number of threads in the wheel
+    uint64_t tick;      // current tick, the deadlines of the previous ones expired
+    uint64_t next;      // no deadline expires before it (a cancelled one may have been the first)
+    uint64_t pending[TIMER_LEVELS]; // bitmaps of the non-empty slots, initialized when set
+    struct timer_slot slots[TIMER_LEVELS][TIMER_SLOTS];
+} timers;
+
+/* a descriptor a thread blocked on, registered in the epoll instance with
+ * EPOLLONESHOT for the union of the events its threads wait for.
+ */
+struct io_fd {
+    thread_waitq_t waiters; // threads blocked on the descriptor, its lock protects the entry
+    int registered;         // the descriptor was added to the epoll instance
+};
+
+// epoll instance of the descriptors threads wait on, created on the first wait
+int io_epfd = -1;
+// two-level table of the descriptors, indexed by their number
+struct io_fd *io_fds[IO_FD_CHUNKS];
+// number of threads blocked on a descriptor or an io_uring request
+unsigned int nr_io_waiting = 0;
+
+#ifdef THREAD_IO_URING
+/* an I/O request submitted to io_uring by a thread, which sleeps until
+ * its completion is reaped.
+ */
+struct io_req {
+    struct thread *th;
+    int res; // result of the operation, -errno on failure
+};
+
+// ring shared by the workers, set up with the epoll instance unless
+// THREAD_IO_URING=0 in the environment or unsupported by the kernel
+struct uring io_ring;
+int io_ring_ok = 0;
+// locks of the submission and completion sides of the ring in M:N mode
+int io_ring_sq_lock = 0;
+int io_ring_cq_lock = 0;
+// signaled by the kernel on each completion, watched by the epoll instance
+int io_ring_eventfd = -1;
+#endif
+
+#ifdef THREAD_MN
+// pool of workers, the first one runs on the kernel thread of main()
+struct worker *workers;
+unsigned int nr_workers = 1;
+// number of workers waiting for a runnable thread
+unsigned int nr_idle = 0;
+// set once the kernel threads of the pool are started
+int workers_started = 0;
+
+// protects preempt_quantum against the workers arming their timer
+pthread_mutex_t preempt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// struct threads whose stack was freed, kept since a deque may still point to
+// them. shared by the workers: the threads released on one worker, like the
+// detached ones, are reused by the worker that creates threads
+TAILQ_HEAD(husk_lifo, thread) husk_hd = TAILQ_HEAD_INITIALIZER(husk_hd);
+pthread_mutex_t husk_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// protects the sleep of idle workers
+pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+// set while an idle worker waits for I/O in epoll_wait(), which io_eventfd interrupts
+int io_polling = 0;
+int io_eventfd = -1;
+// signaled when a thread becomes runnable while some workers are idle,
+// its timed waits use CLOCK_MONOTONIC as the deadlines (see workers_init())
+pthread_cond_t idle_cond;
+
+// worker running on the calling kernel thread
+static __thread struct worker *self_worker __attribute__((tls_model("initial-exec")));
 
 /**
- * frees the memory allocated to the abandoned threads
- * when main() returns/exits.
+ * returns the worker of the calling kernel thread.
+ * a thread can be resumed by another worker after any switch, so the address of
+ * the TLS variable must not be cached by the compiler across calls: this function
+ * is never inlined and cannot be considered pure.
  */
-__attribute__ ((destructor)) void free_thread(void) {
-    // free the abandoned threads
-    while (!TAILQ_EMPTY(&abandoned_hd)) {
-        struct thread *th = TAILQ_FIRST(&abandoned_hd);
-        TAILQ_REMOVE(&abandoned_hd, th, threads);
-        VALGRIND_STACK_DEREGISTER(th->valgrind_stackid);
-        free(th->uctx.uc_stack.ss_sp);
-        free(th);
+__attribute__((noinline)) static struct worker *worker_self(void) {
+    __asm__ volatile("" ::: "memory");
+    return self_worker;
+}
+#else
+// the only worker
+struct worker main_worker;
+
+static inline struct worker *worker_self(void) {
+    return &main_worker;
+}
+#endif
+
+/**
+ * disables the preemption of the running thread, around the critical sections
+ * of the scheduler. calls nest. the counter belongs to the thread rather than
+ * to the worker: a thread preempted in the middle of the increment finds it
+ * back to zero when it is resumed, possibly by another worker.
+ * a thread that is not running always has preemption disabled.
+ */
+static inline void preempt_disable(void) {
+    worker_self()->current->preempt_off++;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * yields the worker at the end of the time slice of th, the running thread.
+ */
+static void preempt_yield(struct thread *th) {
+#ifdef THREAD_STATS
+    th->stats_preempted = 1;
+#endif
+    thread_yield();
+#ifdef THREAD_STATS
+    th->stats_preempted = 0;
+#else
+    (void)th;
+#endif
+}
+
+/**
+ * enables the preemption of the running thread again, and yields if its
+ * time slice ended in the meantime.
+ */
+static inline void preempt_enable(void) {
+    struct thread *curr_th = worker_self()->current;
+
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (--curr_th->preempt_off == 0 && curr_th->preempt_pending) {
+        curr_th->preempt_pending = 0;
+        preempt_yield(curr_th);
     }
 }
 
 /**
- * initializes the main thread (and context) and adds it to runnable FIFO
+ * reserves a stack of size bytes (rounded up to whole pages) with guard pages
+ * below it, so that an overflow faults instead of corrupting other memory.
+ * the memory is not committed: only the pages the thread touches count in RSS.
+ * returns the lowest usable address of the stack, or NULL on failure.
  */
-__attribute__((constructor)) void init_thread(void) {
-    // set the flag and priority of main context
-    main_th.flags |= MAIN;
-    main_th.p = NORMAL;
+static void *stack_alloc(size_t size) {
+    size_t guard = STACK_GUARD_PAGES * page_size;
+    char *base = mmap(NULL, guard + size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
 
-    // init the context for the main thread
-    getcontext(&main_th.uctx);
+    // stacks grow down: the guard is at the low end of the mapping
+    if (mprotect(base, guard, PROT_NONE) != 0) {
+        munmap(base, guard + size);
+        return NULL;
+    }
 
-    // add main thread to runnable fifo
-    current_th = &main_th;
+    return base + guard;
 }
 
-/* terminer le thread courant en renvoyant la valeur de retour retval.
- * cette fonction ne retourne jamais.
- *
- * L'attribut noreturn aide le compilateur à optimiser le code de
- * l'application (élimination de code mort). Attention à ne pas mettre
- * cet attribut dans votre interface tant que votre thread_exit()
- * n'est pas correctement implémenté (il ne doit jamais retourner).
+/**
+ * unmaps a stack returned by stack_alloc() and its guard pages.
  */
-void thread_exit(void *retval) {
-    // get the thread at the head of runnable FIFO
-    struct thread *curr_th = current_th;
+static void stack_free(void *stack, size_t size) {
+    size_t guard = STACK_GUARD_PAGES * page_size;
+    munmap((char *)stack - guard, guard + size);
+}
 
-    // add it to abandoned FIFO
-    if (!(curr_th->flags & MAIN)) {
-        TAILQ_INSERT_TAIL(&abandoned_hd, curr_th, threads);
+/**
+ * rounds a stack size up to whole pages.
+ */
+static size_t stack_round(size_t size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * allocates a struct thread and its stack of size bytes (whole pages).
+ * returns NULL if the allocation fails.
+ */
+static struct thread *thread_alloc(size_t size) {
+    struct thread *th;
+
+#ifdef THREAD_MN
+    pthread_mutex_lock(&husk_mutex);
+    th = TAILQ_FIRST(&husk_hd);
+    if (th != NULL)
+        TAILQ_REMOVE(&husk_hd, th, threads);
+    pthread_mutex_unlock(&husk_mutex);
+    if (th == NULL) {
+        th = malloc(sizeof(struct thread));
+        if (th == NULL)
+            return NULL;
+        th->queued = 0;
+        memset(th->specific, 0, sizeof(th->specific));
+        th->specific_ext = NULL;
+        th->specific_ext_size = 0;
+    }
+#else
+    th = malloc(sizeof(struct thread));
+    if (th == NULL)
+        return NULL;
+    memset(th->specific, 0, sizeof(th->specific));
+    th->specific_ext = NULL;
+    th->specific_ext_size = 0;
+#endif
+
+    th->stack_size = size;
+    th->stack = stack_alloc(th->stack_size);
+    if (th->stack == NULL) {
+#ifdef THREAD_MN
+        pthread_mutex_lock(&husk_mutex);
+        TAILQ_INSERT_HEAD(&husk_hd, th, threads);
+        pthread_mutex_unlock(&husk_mutex);
+#else
+        free(th);
+#endif
+        return NULL;
     }
+    th->valgrind_stackid = VALGRIND_STACK_REGISTER(th->stack, th->stack + th->stack_size);
+
+    return th;
+}
+
+/**
+ * frees a struct thread and its stack.
+ * in M:N mode, a claimed thread can be left behind in a deque (see runq_claim()),
+ * so the struct is kept as a husk for thread_alloc() until the process exits.
+ */
+static void thread_free(struct thread *th) {
+    VALGRIND_STACK_DEREGISTER(th->valgrind_stackid);
+    stack_free(th->stack, th->stack_size);
+#ifdef THREAD_MN
+    pthread_mutex_lock(&husk_mutex);
+    TAILQ_INSERT_HEAD(&husk_hd, th, threads);
+    pthread_mutex_unlock(&husk_mutex);
+#else
+    free(th->specific_ext);
+    free(th);
+#endif
+}
+
+/**
+ * takes a thread from the cache of the worker, or allocates a new one if the
+ * cache is empty. only threads with the default stack size are cached.
+ */
+static struct thread *thread_get(size_t size) {
+    struct worker *w = worker_self();
+    struct thread *th = NULL;
 
-    // change current exiting thread master priority back to high
-    if (curr_th->master) {
-        curr_th->master->p = HIGH;
-        TAILQ_INSERT_HEAD(&high_prio_hd, curr_th->master, threads);
+    if (size == default_stack_size) {
+        // the most recently released thread has the warmest stack
+        th = TAILQ_FIRST(&w->cached_hd);
+        if (th != NULL) {
+            TAILQ_REMOVE(&w->cached_hd, th, threads);
+            w->cached_count--;
+        }
     }
 
-    // if this is not the last thread in runnable FIFO
-    if (!TAILQ_EMPTY(&high_prio_hd)) {
-        // set retval in the thread structure
-        curr_th->retval = retval;
+    return th != NULL ? th : thread_alloc(size);
+}
+
+/**
+ * gives a joined thread back to the cache of the worker, or frees it if the cache is full.
+ */
+static void thread_put(struct thread *th) {
+    struct worker *w = worker_self();
 
-        // make the thread joinable
-        curr_th->flags |= JOINABLE;
+    if (w->cached_count >= cached_max || th->stack_size != default_stack_size) {
+        thread_free(th);
+        return;
+    }
 
-        // resume context of the next thread in runnable FIFO
-        struct thread *old_th = current_th;
-        current_th = TAILQ_FIRST(&high_prio_hd);
-        
-        // remove it from runnable FIFO
-        TAILQ_REMOVE(&high_prio_hd, current_th, threads);
+    TAILQ_INSERT_HEAD(&w->cached_hd, th, threads);
+    w->cached_count++;
+}
 
-        swapcontext(&old_th->uctx, &current_th->uctx);
+/* configurer le cache de threads recyclés après join.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_cache_config(unsigned int max, unsigned int prewarm) {
+    struct worker *w;
+    int ret = 0;
 
-    } else if (!TAILQ_EMPTY(&runnable_hd)) {
-        // set retval in the thread structure
-        curr_th->retval = retval;
+    if (prewarm > max)
+        return -1;
 
-        // make the thread joinable
-        curr_th->flags |= JOINABLE;
+    // in M:N mode each worker has its own cache, the calling one is pre-allocated
+    preempt_disable();
+    w = worker_self();
 
-        // resume context of the next thread in runnable FIFO
-        struct thread *old_th = current_th;
-        current_th = TAILQ_FIRST(&runnable_hd);
-        
-        // remove it from runnable FIFO
-        TAILQ_REMOVE(&runnable_hd, current_th, threads);
+    cached_max = max;
 
-        swapcontext(&old_th->uctx, &current_th->uctx);
+    // shrink the cache down to the new high-water mark
+    while (w->cached_count > cached_max) {
+        struct thread *th = TAILQ_FIRST(&w->cached_hd);
+        TAILQ_REMOVE(&w->cached_hd, th, threads);
+        w->cached_count--;
+        thread_free(th);
+    }
 
-    } else if (!(curr_th->flags & MAIN)) { // the last thread isnt the main thread
-        // restore context of main thread to clean up with destructor
-        current_th = &main_th;
-        setcontext(&main_th.uctx);
+    // pre-allocate entries so that the first calls to thread_create() hit the cache
+    while (w->cached_count < prewarm) {
+        struct thread *th = thread_alloc(default_stack_size);
+        if (th == NULL) {
+            ret = -1;
+            break;
+        }
+        TAILQ_INSERT_HEAD(&w->cached_hd, th, threads);
+        w->cached_count++;
     }
 
-    exit(EXIT_SUCCESS);
+    preempt_enable();
+    return ret;
 }
 
-void thread_runner(void) {
-    // get the thread at the head of runnable FIFO
-    struct thread *curr_th = current_th;
+/**
+ * spins until no worker runs th anymore, i.e. until its context is saved.
+ * this only takes the few instructions left in the switch away from th.
+ */
+static void wait_off_cpu(struct thread *th) {
+#ifdef THREAD_MN
+    unsigned int spins = 0;
 
-    // call the entry function of the thread and pass the return value to thread_exit
-    thread_exit(curr_th->func(curr_th->funcarg));
+    while (__atomic_load_n(&th->on_cpu, __ATOMIC_ACQUIRE)) {
+        // the other worker may have been preempted by the kernel
+        if (++spins % 64 == 0)
+            sched_yield();
+    }
+#else
+    (void)th;
+#endif
 }
 
-/* recuperer l'identifiant du thread courant.
+/**
+ * takes a spinlock against the other workers in M:N mode.
+ * preemption must be disabled while it is held.
  */
-thread_t thread_self(void) {
-    // get the calling thread from runnable fifo
-    return (thread_t)current_th;
+static inline void spin_lock(int *lock) {
+#ifdef THREAD_MN
+    unsigned int spins = 0;
+
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            // the holder may have been preempted by the kernel
+            if (++spins % 64 == 0)
+                sched_yield();
+        }
+    }
+#else
+    (void)lock;
+#endif
 }
 
-/* creer un nouveau thread qui va exécuter la fonction func avec l'argument funcarg.
- * renvoie 0 en cas de succès, -1 en cas d'erreur.
+/**
+ * tries to take a spinlock, returns 1 on success.
  */
-int thread_create(thread_t *newthread, void *(*func)(void *), void *funcarg) {
-    // allocate a struct thread instance for the new thread
-    struct thread *thn = malloc(sizeof(struct thread));
-    thn->flags = 0U;
-    thn->func = func;
-    thn->funcarg = funcarg;
-    thn->retval = NULL;
-    thn->p = NORMAL;
-    thn->master = NULL;
+static inline int spin_trylock(int *lock) {
+#ifdef THREAD_MN
+    return !__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE);
+#else
+    (void)lock;
+    return 1;
+#endif
+}
 
-    // set the thread id as the pointer to its struct thread instance
-    *newthread = (thread_t)thn;
+static inline void spin_unlock(int *lock) {
+#ifdef THREAD_MN
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+#else
+    (void)lock;
+#endif
+}
 
-    // set up the context of the new thread
-    getcontext(&thn->uctx);
-    thn->uctx.uc_link = NULL;
-    thn->uctx.uc_stack.ss_size = STACK_SIZE;
-    thn->uctx.uc_stack.ss_sp = malloc(thn->uctx.uc_stack.ss_size);
-    thn->valgrind_stackid = VALGRIND_STACK_REGISTER(thn->uctx.uc_stack.ss_sp,
-                                                   thn->uctx.uc_stack.ss_sp + thn->uctx.uc_stack.ss_size);
-    // set the thread runner as entry point
-    makecontext(&thn->uctx, thread_runner, 0);
+/**
+ * locks a wait queue against the other workers in M:N mode.
+ */
+static inline void waitq_lock(thread_waitq_t *q) {
+    spin_lock(&q->lock);
+}
 
-    // add new thread to runnable FIFO
-    TAILQ_INSERT_TAIL(&runnable_hd, thn, threads);
+/**
+ * tries to lock a wait queue, returns 1 on success.
+ */
+static inline int waitq_trylock(thread_waitq_t *q) {
+    return spin_trylock(&q->lock);
+}
 
-    return 0;
+static inline void waitq_unlock(thread_waitq_t *q) {
+    spin_unlock(&q->lock);
 }
 
-/* passer la main à un autre thread.
+static void thread_wake(struct thread *th);
+static void keys_destroy(struct thread *th);
+
+/**
+ * returns the time of CLOCK_MONOTONIC in nanoseconds, the clock of the deadlines.
  */
-int thread_yield(void) {
-    // get backup value of old thread
-    struct thread *old_th = current_th;
+static uint64_t clock_ns(void) {
+    struct timespec ts;
 
-    // insert old thread at tail
-    switch (old_th->p) {
-        case NORMAL:
-            TAILQ_INSERT_TAIL(&runnable_hd, old_th, threads);
-            break;
-        case HIGH:
-            TAILQ_INSERT_TAIL(&high_prio_hd, old_th, threads);
-            break;
-        case LOW:
-            break;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    // get the next thread in runnable FIFO and remove it from runnable FIFO
-    if (!TAILQ_EMPTY(&high_prio_hd)) {
-        current_th = TAILQ_FIRST(&high_prio_hd);
-        TAILQ_REMOVE(&high_prio_hd, current_th, threads);
-    } else {
-        current_th = TAILQ_FIRST(&runnable_hd);
-        TAILQ_REMOVE(&runnable_hd, current_th, threads);
-    }
-   
-    // swap to the context of next thread
-    swapcontext(&old_th->uctx, &current_th->uctx);
+/**
+ * converts an absolute time of CLOCK_REALTIME, as taken by the pthread
+ * functions, to a deadline of CLOCK_MONOTONIC. a deadline is never 0.
+ */
+static uint64_t deadline_from_abstime(const struct timespec *abstime) {
+    struct timespec now;
+    int64_t delta;
 
-    return 0;
+    clock_gettime(CLOCK_REALTIME, &now);
+    delta = (int64_t)(abstime->tv_sec - now.tv_sec) * 1000000000LL + (abstime->tv_nsec - now.tv_nsec);
+
+    return clock_ns() + (delta > 0 ? delta : 0) + 1;
 }
 
-/* Cette fonction permet de passer la main au thread t*/
-int thread_yield_to(struct thread * t) {
-    // get backup value of old thread
-    struct thread *old_th = current_th;
+/*      Traces de l'ordonnanceur      */
 
-    // insert old thread at tail
-    switch (old_th->p) {
-        case NORMAL:
-            TAILQ_INSERT_TAIL(&runnable_hd, old_th, threads);
-            break;
-        case HIGH:
-            TAILQ_INSERT_TAIL(&high_prio_hd, old_th, threads);
-            break;
-        case LOW:
-            break;
-    }
 
-    // remove the thread t from the list
-    switch (t->p) {
-        case NORMAL:
-            TAILQ_REMOVE(&runnable_hd, t, threads);
-            break;
-        case HIGH:
-            TAILQ_REMOVE(&high_prio_hd, t, threads);
-            break;
-        case LOW:
-            break;
-    }
+// kinds of trace events, the format of the dump is read by graphs/trace_script.py
+enum trace_type {
+    TRACE_CREATE,       // thread created by arg
+    TRACE_SWITCH,       // worker switched from arg to thread
+    TRACE_YIELD,
+    TRACE_BLOCK,        // thread blocked in the wait queue arg
+    TRACE_WAKE,         // thread made runnable by arg
+    TRACE_EXIT,
+    TRACE_MUTEX_WAIT,   // thread waits for the mutex arg
+    TRACE_MUTEX_HANDOFF // mutex arg handed over to thread
+};
 
-    // get the next thread in runnable FIFO
-    current_th = t;
+struct trace_event {
+    uint64_t tsc;    // see trace_clock()
+    uint64_t thread;
+    uint64_t arg;
+    uint32_t type;
+    uint32_t pad;
+};
 
-    // swap to the context of next thread
-    swapcontext(&old_th->uctx, &current_th->uctx);
+/* last THREAD_TRACE_EVENTS events of a worker. only the worker writes to it,
+ * without locks nor atomic read-modify-write: the oldest events are overwritten.
+ */
+struct trace_ring {
+    uint64_t head; // number of events recorded so far
+    struct trace_event events[THREAD_TRACE_EVENTS];
+};
 
-    return 0;
+// set while the events are recorded, see thread_trace_config()
+int trace_on = 0;
+// file the rings are dumped to
+static char *trace_path;
+// trace_clock() and clock_ns() when tracing was enabled, to convert the timestamps
+static uint64_t trace_tsc0, trace_ns0;
+
+/**
+ * returns the timestamp counter of the CPU, or clock_ns() where there is none.
+ */
+static inline uint64_t trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return clock_ns();
+#endif
 }
 
-/* attendre la fin d'exécution d'un thread.
- * la valeur renvoyée par le thread est placée dans *retval.
- * si retval est NULL, la valeur de retour est ignorée.
+__attribute__((noinline, cold)) static void trace_record(enum trace_type type, const void *th, const void *arg) {
+    struct trace_ring *r = worker_self()->trace;
+    struct trace_event *e;
+
+    if (r == NULL)
+        return;
+    e = &r->events[r->head & (THREAD_TRACE_EVENTS - 1)];
+    e->tsc = trace_clock();
+    e->thread = (uintptr_t)th;
+    e->arg = (uintptr_t)arg;
+    e->type = type;
+    // the dump may read the ring from another worker
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * records a scheduler event in the ring of the worker, if tracing is enabled.
  */
-int thread_join(thread_t thread, void **retval) {
-    // cast the thread ID back to (struct thread *)
-    struct thread *th = (struct thread *)thread;
+static inline void trace(enum trace_type type, const void *th, const void *arg) {
+    if (__builtin_expect(__atomic_load_n(&trace_on, __ATOMIC_RELAXED), 0))
+        trace_record(type, th, arg);
+}
+
+/**
+ * writes the rings to trace_path: a header ("THRTRACE", version, number of
+ * rings, TSC ticks per ns and the TSC when tracing started), then for each
+ * worker its number, the number of events recorded and the events kept, oldest
+ * first. the events recorded meanwhile by the other workers may be torn.
+ * returns 0 on success, -1 on error.
+ */
+static int trace_dump(void) {
+#ifdef THREAD_MN
+    struct worker *ws = workers;
+    uint32_t nr = nr_workers;
+#else
+    struct worker *ws = &main_worker;
+    uint32_t nr = 1;
+#endif
+    uint32_t version = 1, i;
+    uint64_t head, first, n;
+    double ticks_per_ns;
+    FILE *f;
+    int ret = 0;
+
+    ticks_per_ns = (double)(trace_clock() - trace_tsc0) / (double)(clock_ns() - trace_ns0 + 1);
+    f = fopen(trace_path, "w");
+    if (f == NULL)
+        return -1;
 
-    // loop until thread becomes JOINABLE
-    if (!(th->flags & JOINABLE)) {
-        th->master = current_th;
-        current_th->p = LOW;
-        if(th->p == NORMAL) {
-            TAILQ_REMOVE(&runnable_hd, th, threads);
-            TAILQ_INSERT_TAIL(&high_prio_hd, th, threads);
-            th->p = HIGH;
+    fwrite("THRTRACE", 1, 8, f);
+    fwrite(&version, sizeof(version), 1, f);
+    fwrite(&nr, sizeof(nr), 1, f);
+    fwrite(&ticks_per_ns, sizeof(ticks_per_ns), 1, f);
+    fwrite(&trace_tsc0, sizeof(trace_tsc0), 1, f);
+    for (i = 0; i < nr; i++) {
+        struct trace_ring *r = ws[i].trace;
+
+        head = r != NULL ? __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) : 0;
+        first = head > THREAD_TRACE_EVENTS ? head - THREAD_TRACE_EVENTS : 0;
+        fwrite(&i, sizeof(i), 1, f);
+        fwrite(&head, sizeof(head), 1, f);
+        n = head - first;
+        fwrite(&n, sizeof(n), 1, f);
+        // in two parts if the ring wrapped around
+        if (n > 0 && (first & (THREAD_TRACE_EVENTS - 1)) + n > THREAD_TRACE_EVENTS) {
+            fwrite(&r->events[first & (THREAD_TRACE_EVENTS - 1)], sizeof(struct trace_event),
+                   THREAD_TRACE_EVENTS - (first & (THREAD_TRACE_EVENTS - 1)), f);
+            fwrite(r->events, sizeof(struct trace_event), head & (THREAD_TRACE_EVENTS - 1), f);
+        } else if (n > 0) {
+            fwrite(&r->events[first & (THREAD_TRACE_EVENTS - 1)], sizeof(struct trace_event), n, f);
         }
-        thread_yield();
     }
 
-    // remove the thread from abandonned FIFO
-    if (!(th->flags & MAIN)) {
-        TAILQ_REMOVE(&abandoned_hd, th, threads);
-    }
+    if (ferror(f))
+        ret = -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    return ret;
+}
 
-    // if retval is not NULL, get the return val set by thread_exit
-    if (retval)
-        *retval = th->retval;
+/* configurer le traçage des événements de l'ordonnanceur.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_trace_config(const char *path) {
+#ifdef THREAD_MN
+    struct worker *ws = workers;
+    unsigned int nr = nr_workers;
+#else
+    struct worker *ws = &main_worker;
+    unsigned int nr = 1;
+#endif
+    unsigned int i;
 
-    // free memory allocated to the thread if not main thread
-    if (!(th->flags & MAIN)) {
-        VALGRIND_STACK_DEREGISTER(th->valgrind_stackid);
-        free(th->uctx.uc_stack.ss_sp);
-        free(th);
+    // stop and dump what was recorded
+    if (path == NULL) {
+        if (!trace_on)
+            return 0;
+        __atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+        return trace_dump();
+    }
+    if (trace_on)
+        return -1;
+
+    // the rings are kept once allocated, the workers may still write to them
+    for (i = 0; i < nr; i++) {
+        if (ws[i].trace == NULL) {
+            ws[i].trace = calloc(1, sizeof(struct trace_ring));
+            if (ws[i].trace == NULL)
+                return -1;
+        }
     }
+    free(trace_path);
+    trace_path = strdup(path);
+    if (trace_path == NULL)
+        return -1;
 
+    trace_tsc0 = trace_clock();
+    trace_ns0 = clock_ns();
+    __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
     return 0;
 }
 
-/*      Implémentation des mutexes      */
+/*      Statistiques de l'ordonnanceur      */
 
 
-int thread_mutex_init(thread_mutex_t *mutex) {
-    if (mutex != NULL) {
-        mutex->is_destroyed = 0;
-        mutex->locker = NULL;
-        return EXIT_SUCCESS;
-    }
+#ifdef THREAD_STATS
+// trace_clock() and clock_ns() at startup, to convert the durations
+static uint64_t stats_tsc0, stats_ns0;
+#endif
 
-    return EXIT_FAILURE;
+/**
+ * charges the time since the last change of state to the state prev leaves,
+ * running, and the one next leaves, runnable, when a worker switches between
+ * them. the time until the next change is charged by the event that ends it:
+ * stats_switch() if prev was put back in the run queue, stats_wake() if it blocked.
+ */
+static inline void stats_switch(struct thread *prev, struct thread *next) {
+#ifdef THREAD_STATS
+    uint64_t now = trace_clock();
+
+    prev->stats.run_ns += now - prev->stats_since;
+    prev->stats_since = now;
+    if (prev->stats_preempted)
+        prev->stats.involuntary_switches++;
+    else
+        prev->stats.voluntary_switches++;
+    next->stats.runnable_ns += now - next->stats_since;
+    next->stats_since = now;
+#else
+    (void)prev;
+    (void)next;
+#endif
 }
 
-int thread_mutex_destroy(thread_mutex_t *mutex) {
-    if (mutex != NULL) {
-        mutex->is_destroyed = 1;
-        mutex->locker = NULL;
-        return EXIT_SUCCESS;
-    }
+/**
+ * charges the time since a thread blocked when it is made runnable again.
+ */
+static inline void stats_wake(struct thread *th) {
+#ifdef THREAD_STATS
+    uint64_t now = trace_clock();
 
-    return EXIT_FAILURE;
+    th->stats.blocked_ns += now - th->stats_since;
+    th->stats_since = now;
+#else
+    (void)th;
+#endif
 }
 
-int thread_mutex_lock(thread_mutex_t *mutex) {
-    struct thread *curr_th = current_th;
+/**
+ * resets the counters of a thread being created, runnable from now on.
+ */
+static inline void stats_create(struct thread *th) {
+#ifdef THREAD_STATS
+    memset(&th->stats, 0, sizeof(th->stats));
+    th->stats_since = trace_clock();
+    th->stats_preempted = 0;
+#else
+    (void)th;
+#endif
+}
 
-    //  we don't block if mutex not initialized/destroyed or owned by calling thread
-    if (mutex == NULL || mutex->is_destroyed != 0 || mutex->locker == (thread_t)curr_th) {
-        return EXIT_FAILURE;
-    }
+static inline void stats_mutex_contended(struct thread *th) {
+#ifdef THREAD_STATS
+    th->stats.mutex_contended++;
+#else
+    (void)th;
+#endif
+}
 
-    // otherwise we block until mutex is available
-    while (mutex->locker != NULL) {
-        // eventually we could yield to locker thread directly 
-        thread_yield_to(mutex->locker);
-    }
+/**
+ * starts the clock of the main thread, running from now on.
+ */
+static void stats_init(void) {
+#ifdef THREAD_STATS
+    stats_tsc0 = trace_clock();
+    stats_ns0 = clock_ns();
+    main_th.stats_since = stats_tsc0;
+#endif
+}
 
-    // lock the mutex
-    mutex->locker = (thread_t)curr_th;
+#ifdef THREAD_STATS
+/**
+ * converts a number of trace_clock() ticks to ns, with the rate measured since startup.
+ */
+static uint64_t stats_to_ns(uint64_t ticks, uint64_t tsc, uint64_t ns) {
+    double ns_per_tick = (double)(ns - stats_ns0) / (double)(tsc - stats_tsc0 + 1);
 
-    return EXIT_SUCCESS;
+    return (uint64_t)(ticks * ns_per_tick);
 }
+#endif
 
-int thread_mutex_unlock(thread_mutex_t *mutex) {
-    struct thread *curr_th = current_th;
+/* lire les statistiques d'un thread.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_stats(thread_t thread, thread_stats_t *stats) {
+#ifdef THREAD_STATS
+    struct thread *th = (struct thread *)thread;
+    uint64_t tsc, ns, elapsed;
+    int running;
 
-    // unlocking a mutex not owned by calling thread is an error
-    if (mutex == NULL || mutex->is_destroyed != 0 || mutex->locker != (thread_t)curr_th) {
-        return EXIT_FAILURE;
-    }
+    if (th == NULL || stats == NULL)
+        return -1;
 
-    // release mutex
-    mutex->locker = NULL;
+    tsc = trace_clock();
+    ns = clock_ns();
+    *stats = th->stats;
+    // charge the time spent in the current state, unless the thread exited.
+    // another worker may have changed it after tsc was read
+    elapsed = tsc - __atomic_load_n(&th->stats_since, __ATOMIC_RELAXED);
+    if (elapsed > tsc - stats_tsc0)
+        elapsed = 0;
+#ifdef THREAD_MN
+    running = __atomic_load_n(&th->on_cpu, __ATOMIC_RELAXED);
+#else
+    running = th == worker_self()->current;
+#endif
+    if (__atomic_load_n(&th->flags, __ATOMIC_RELAXED) & JOINABLE)
+        ;
+    else if (running)
+        stats->run_ns += elapsed;
+    else if (__atomic_load_n(&th->state, __ATOMIC_RELAXED) == BLOCKED)
+        stats->blocked_ns += elapsed;
+    else
+        stats->runnable_ns += elapsed;
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    stats->run_ns = stats_to_ns(stats->run_ns, tsc, ns);
+    stats->runnable_ns = stats_to_ns(stats->runnable_ns, tsc, ns);
+    stats->blocked_ns = stats_to_ns(stats->blocked_ns, tsc, ns);
+    return 0;
+#else
+    (void)thread;
+    (void)stats;
+    return -1;
+#endif
+}
+
+/* lire les statistiques globales de l'ordonnanceur.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_stats_global(thread_global_stats_t *stats) {
+#ifdef THREAD_STATS
+#ifdef THREAD_MN
+    struct worker *ws = workers;
+    unsigned int nr = nr_workers;
+#else
+    struct worker *ws = &main_worker;
+    unsigned int nr = 1;
+    struct thread *th;
+#endif
+    unsigned int i;
+    int p;
+
+    if (stats == NULL)
+        return -1;
+
+    stats->threads = __atomic_load_n(&nr_threads, __ATOMIC_RELAXED);
+    stats->io_waiting = __atomic_load_n(&nr_io_waiting, __ATOMIC_RELAXED);
+    stats->runnable = 0;
+    stats->switches = 0;
+    for (i = 0; i < nr; i++) {
+        stats->switches += __atomic_load_n(&ws[i].nr_switches, __ATOMIC_RELAXED);
+        stats->runnable += __atomic_load_n(&ws[i].fair_runq.count, __ATOMIC_RELAXED);
+#ifdef THREAD_MN
+        for (p = 0; p < NR_PRIO; p++) {
+            long size = __atomic_load_n(&ws[i].runq[p].bottom, __ATOMIC_RELAXED)
+                        - __atomic_load_n(&ws[i].runq[p].top, __ATOMIC_RELAXED);
+
+            if (size > 0)
+                stats->runnable += size;
+        }
+#endif
+    }
+#ifndef THREAD_MN
+    for (p = 0; p < NR_PRIO; p++)
+        TAILQ_FOREACH(th, &runnable_hd[p], threads)
+            stats->runnable++;
+#endif
+    return 0;
+#else
+    (void)stats;
+    return -1;
+#endif
+}
+
+/*      Mesure de l'usage des piles      */
+
+
+/* stack usage of the threads that exited with an entry function: their number,
+ * the sum and the largest of their usages, and their histogram.
+ */
+struct stack_profile {
+    void *(*func)(void *); // entry function, NULL while the slot is free
+    uint64_t threads;
+    uint64_t total;
+    size_t max;
+    uint64_t hist[STACK_HIST_BUCKETS];
+};
+
+// set while the stacks are painted at creation, see thread_stack_config()
+int stack_profile_on = 0;
+// file the report is written to
+static char *stack_profile_path;
+// open addressing on the entry function, allocated when first enabled
+static struct stack_profile *stack_profiles;
+// the functions that did not fit in stack_profiles, and all the threads together
+static struct stack_profile stack_profile_other, stack_profile_all;
+// protects the profiles, updated by the exiting threads of every worker
+static int stack_profile_lock;
+
+/**
+ * fills the stack of a thread being created with STACK_CANARY, before its
+ * context is made. the whole stack is committed.
+ */
+static void stack_paint(struct thread *th) {
+    uint64_t *p = th->stack, *end = (uint64_t *)((char *)th->stack + th->stack_size);
+
+    while (p < end)
+        *p++ = STACK_CANARY;
+}
+
+/**
+ * returns the bytes of its stack a painted thread used: the words above the
+ * lowest one that lost its canary. a frame that skipped some words without
+ * writing them is still counted, the stack grows down.
+ */
+static size_t stack_used(struct thread *th) {
+    uint64_t *p = th->stack, *end = (uint64_t *)((char *)th->stack + th->stack_size);
+
+    while (p < end && *p == STACK_CANARY)
+        p++;
+    return (char *)end - (char *)p;
+}
+
+static void stack_profile_add(struct stack_profile *sp, size_t used) {
+    unsigned int b = 0;
+
+    while (b < STACK_HIST_BUCKETS - 1 && used >= (size_t)1024 << b)
+        b++;
+    sp->threads++;
+    sp->total += used;
+    if (used > sp->max)
+        sp->max = used;
+    sp->hist[b]++;
+}
+
+/**
+ * adds the stack usage of the running thread, which exits, to the profile of
+ * its entry function. preemption must be disabled.
+ */
+static void stack_profile_record(struct thread *th) {
+    size_t used = stack_used(th);
+    uintptr_t h = (uintptr_t)th->func;
+    unsigned int i, slot;
+    struct stack_profile *sp = &stack_profile_other;
+
+    // the low bits of a code address carry little entropy
+    h = (h >> 4) * 0x9e3779b97f4a7c15ULL;
+    spin_lock(&stack_profile_lock);
+    for (i = 0; i < STACK_PROFILE_FUNCS; i++) {
+        slot = (h + i) & (STACK_PROFILE_FUNCS - 1);
+        if (stack_profiles[slot].func == NULL)
+            stack_profiles[slot].func = th->func;
+        if (stack_profiles[slot].func == th->func) {
+            sp = &stack_profiles[slot];
+            break;
+        }
+    }
+    stack_profile_add(sp, used);
+    stack_profile_add(&stack_profile_all, used);
+    spin_unlock(&stack_profile_lock);
+}
+
+/**
+ * finds the object that contains the address in data[0], and sets data[1]
+ * to its path and data[0] to the offset of the address in it.
+ */
+static int stack_profile_object(struct dl_phdr_info *info, size_t size, void *data) {
+    uintptr_t *addr = data;
+    int i;
+
+    (void)size;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+
+        if (ph->p_type == PT_LOAD && addr[0] >= start && addr[0] < start + ph->p_memsz) {
+            addr[0] -= info->dlpi_addr;
+            addr[1] = (uintptr_t)info->dlpi_name;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * writes a profile on a line: its name, its number of threads, their largest
+ * and mean usage, the suggested stack size, and the histogram.
+ */
+static void stack_profile_write(FILE *f, const char *name, const struct stack_profile *sp) {
+    size_t hint = stack_round(sp->max + sp->max / 4);
+    unsigned int b;
+
+    if (hint < THREAD_STACK_MIN)
+        hint = THREAD_STACK_MIN;
+    fprintf(f, "%s threads=%llu max=%zu mean=%llu hint=%zu hist=", name,
+            (unsigned long long)sp->threads, sp->max,
+            (unsigned long long)(sp->threads ? sp->total / sp->threads : 0), hint);
+    for (b = 0; b < STACK_HIST_BUCKETS; b++)
+        fprintf(f, b ? ",%llu" : "%llu", (unsigned long long)sp->hist[b]);
+    fputc('\n', f);
+}
+
+/**
+ * writes the report to stack_profile_path: a comment giving the default
+ * stack size and the bounds of the buckets, the line of all the threads,
+ * then one per entry function, named by its address, the object that
+ * contains it and the offset in that object (for addr2line -e), and the
+ * line of the functions merged for lack of room.
+ * returns 0 on success, -1 on error.
+ */
+static int stack_profile_dump(void) {
+    char name[PATH_MAX + 64];
+    unsigned int i, b;
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(stack_profile_path, "w");
+    if (f == NULL)
+        return -1;
+
+    preempt_disable();
+    spin_lock(&stack_profile_lock);
+    fprintf(f, "# stack=%zu hist=", default_stack_size);
+    for (b = 0; b < STACK_HIST_BUCKETS - 1; b++)
+        fprintf(f, "<%zu,", (size_t)1024 << b);
+    fprintf(f, ">=%zu\n", (size_t)1024 << (STACK_HIST_BUCKETS - 1));
+    stack_profile_write(f, "all", &stack_profile_all);
+    for (i = 0; i < STACK_PROFILE_FUNCS; i++) {
+        struct stack_profile *sp = &stack_profiles[i];
+        uintptr_t obj[2] = { (uintptr_t)sp->func, (uintptr_t)"?" };
+
+        if (sp->func == NULL)
+            continue;
+        dl_iterate_phdr(stack_profile_object, obj);
+        snprintf(name, sizeof(name), "func=%p object=%s+0x%lx", (void *)sp->func,
+                 *(const char *)obj[1] ? (const char *)obj[1] : program_invocation_name, (unsigned long)obj[0]);
+        stack_profile_write(f, name, sp);
+    }
+    if (stack_profile_other.threads > 0)
+        stack_profile_write(f, "other", &stack_profile_other);
+    spin_unlock(&stack_profile_lock);
+    preempt_enable();
+
+    if (ferror(f))
+        ret = -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    return ret;
+}
+
+/* configurer la mesure de l'usage des piles.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_stack_config(const char *path) {
+    // stop and write what was measured
+    if (path == NULL) {
+        if (!stack_profile_on)
+            return 0;
+        __atomic_store_n(&stack_profile_on, 0, __ATOMIC_RELAXED);
+        return stack_profile_dump();
+    }
+    if (stack_profile_on)
+        return -1;
+
+    // kept once allocated, the painted threads still running record into it
+    if (stack_profiles == NULL) {
+        stack_profiles = calloc(STACK_PROFILE_FUNCS, sizeof(struct stack_profile));
+        if (stack_profiles == NULL)
+            return -1;
+    }
+    free(stack_profile_path);
+    stack_profile_path = strdup(path);
+    if (stack_profile_path == NULL)
+        return -1;
+
+    preempt_disable();
+    spin_lock(&stack_profile_lock);
+    memset(stack_profiles, 0, STACK_PROFILE_FUNCS * sizeof(struct stack_profile));
+    memset(&stack_profile_other, 0, sizeof(stack_profile_other));
+    memset(&stack_profile_all, 0, sizeof(stack_profile_all));
+    spin_unlock(&stack_profile_lock);
+    preempt_enable();
+    __atomic_store_n(&stack_profile_on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * inserts a thread in the slot of its deadline, the wheel must be locked.
+ */
+static void timer_insert(struct thread *th) {
+    uint64_t expires = th->deadline >> TIMER_TICK_SHIFT;
+    unsigned int level = 0, slot;
+
+    // the deadlines that passed expire at the current tick
+    if (expires < timers.tick)
+        expires = timers.tick;
+
+    while (level < TIMER_LEVELS - 1
+           && expires >> (TIMER_BITS * (level + 1)) != timers.tick >> (TIMER_BITS * (level + 1)))
+        level++;
+    slot = (expires >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1);
+    // beyond the wheel, the last slot is inserted again when cascaded
+    if (expires >> (TIMER_BITS * TIMER_LEVELS) != timers.tick >> (TIMER_BITS * TIMER_LEVELS))
+        slot = TIMER_SLOTS - 1;
+
+    if (!(timers.pending[level] & (1ULL << slot))) {
+        TAILQ_INIT(&timers.slots[level][slot]);
+        timers.pending[level] |= 1ULL << slot;
+    }
+    TAILQ_INSERT_TAIL(&timers.slots[level][slot], th, timeouts);
+    th->timer_slot = &timers.slots[level][slot];
+}
+
+/**
+ * removes a thread from its slot, the wheel must be locked.
+ */
+static void timer_remove(struct thread *th) {
+    struct timer_slot *slot = th->timer_slot;
+    unsigned int i;
+
+    TAILQ_REMOVE(slot, th, timeouts);
+    if (TAILQ_EMPTY(slot)) {
+        i = slot - &timers.slots[0][0];
+        timers.pending[i / TIMER_SLOTS] &= ~(1ULL << (i % TIMER_SLOTS));
+    }
+    th->timer_slot = NULL;
+}
+
+/**
+ * moves the threads of the upper level slots entered by the current tick down
+ * the wheel, the wheel must be locked.
+ */
+static void timer_cascade(void) {
+    struct thread *th, *next;
+    unsigned int level, slot;
+
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        slot = (timers.tick >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1);
+        if (timers.pending[level] & (1ULL << slot)) {
+            // the slot is emptied first, a thread beyond the wheel goes back to it
+            timers.pending[level] &= ~(1ULL << slot);
+            for (th = TAILQ_FIRST(&timers.slots[level][slot]); th != NULL; th = next) {
+                next = TAILQ_NEXT(th, timeouts);
+                timer_insert(th);
+            }
+        }
+        // the next level only moves on when this one wraps around
+        if (slot != 0)
+            break;
+    }
+}
+
+/**
+ * returns the first tick at which a slot holding threads starts, from the
+ * current one or after it, and sets *level to its level. returns UINT64_MAX
+ * if the wheel is empty. the wheel must be locked.
+ */
+static uint64_t timer_next_tick(int after, unsigned int *level) {
+    uint64_t mask;
+    unsigned int slot, shift;
+
+    if (timers.count == 0)
+        return UINT64_MAX;
+
+    for (*level = 0; *level < TIMER_LEVELS; (*level)++) {
+        shift = TIMER_BITS * *level;
+        slot = (timers.tick >> shift) & (TIMER_SLOTS - 1);
+        // the current slot of an upper level was cascaded already
+        if (*level == 0 && !after)
+            mask = ~0ULL << slot;
+        else
+            mask = slot < TIMER_SLOTS - 1 ? ~0ULL << (slot + 1) : 0;
+        mask &= timers.pending[*level];
+        if (mask != 0)
+            return (timers.tick >> (shift + TIMER_BITS) << TIMER_BITS | __builtin_ctzll(mask)) << shift;
+    }
+
+    // only deadlines beyond the wheel are left, moved on with the last level
+    *level = TIMER_LEVELS - 1;
+    return ((timers.tick >> (TIMER_BITS * TIMER_LEVELS)) + 1) << (TIMER_BITS * TIMER_LEVELS);
+}
+
+/**
+ * returns the time before which no deadline expires, the wheel must be locked.
+ * the first deadline of level 0 is exact, a slot of an upper level gives its start.
+ */
+static uint64_t timer_first(void) {
+    struct thread *th;
+    uint64_t tick, first = UINT64_MAX;
+    unsigned int level;
+
+    tick = timer_next_tick(0, &level);
+    if (tick == UINT64_MAX || level > 0)
+        return tick == UINT64_MAX ? tick : tick << TIMER_TICK_SHIFT;
+
+    TAILQ_FOREACH(th, &timers.slots[0][tick & (TIMER_SLOTS - 1)], timeouts)
+        if (th->deadline < first)
+            first = th->deadline;
+    return first;
+}
+
+/**
+ * adds a thread blocked in a wait queue, which must be locked, to the timer wheel.
+ */
+static void timeout_add(struct thread *th, uint64_t deadline) {
+    th->deadline = deadline;
+
+    spin_lock(&timers.lock);
+    // an empty wheel moves on to the current tick at once
+    if (timers.count == 0)
+        timers.tick = clock_ns() >> TIMER_TICK_SHIFT;
+    timer_insert(th);
+    __atomic_store_n(&timers.count, timers.count + 1, __ATOMIC_RELAXED);
+    if (deadline < timers.next || timers.count == 1)
+        __atomic_store_n(&timers.next, deadline, __ATOMIC_RELAXED);
+    spin_unlock(&timers.lock);
+}
+
+/**
+ * removes a thread woken up before its deadline from the timer wheel.
+ * the wait queue of the thread must be locked.
+ */
+static void timeout_cancel(struct thread *th) {
+    spin_lock(&timers.lock);
+    timer_remove(th);
+    __atomic_store_n(&timers.count, timers.count - 1, __ATOMIC_RELAXED);
+    th->deadline = 0;
+    spin_unlock(&timers.lock);
+}
+
+/**
+ * returns the time until which no deadline expires, 0 if no thread waits for one.
+ * it may be earlier than the first deadline, the caller then gets back here.
+ */
+static uint64_t timeout_next(void) {
+    if (__atomic_load_n(&timers.count, __ATOMIC_RELAXED) == 0)
+        return 0;
+
+    return __atomic_load_n(&timers.next, __ATOMIC_RELAXED);
+}
+
+/**
+ * wakes up the threads whose deadline passed, which return ETIMEDOUT, moving
+ * the wheel up to the current tick.
+ * the wheel is locked before the wait queue of the thread, against the order
+ * of the wakers: the wait queue is only tried, and while the thread is in the
+ * wheel its wait queue cannot be destroyed.
+ */
+static void timeouts_expire(void) {
+    struct timer_slot expired = TAILQ_HEAD_INITIALIZER(expired);
+    struct thread *th, *next;
+    uint64_t now, now_tick, next_tick;
+    unsigned int slot, level;
+
+    if (__atomic_load_n(&timers.count, __ATOMIC_RELAXED) == 0)
+        return;
+    now = clock_ns();
+    if (now < __atomic_load_n(&timers.next, __ATOMIC_RELAXED))
+        return;
+    now_tick = now >> TIMER_TICK_SHIFT;
+
+retry:
+    spin_lock(&timers.lock);
+    while (timers.count > 0) {
+        slot = timers.tick & (TIMER_SLOTS - 1);
+        if (timers.pending[0] & (1ULL << slot)) {
+            for (th = TAILQ_FIRST(&timers.slots[0][slot]); th != NULL; th = next) {
+                next = TAILQ_NEXT(th, timeouts);
+                if (th->deadline > now)
+                    continue;
+                if (!waitq_trylock(th->waitq)) {
+                    spin_unlock(&timers.lock);
+                    goto retry;
+                }
+                timer_remove(th);
+                timers.count--;
+                TAILQ_REMOVE(th->waitq, th, threads);
+                waitq_unlock(th->waitq);
+
+                th->deadline = 0;
+                th->waitq = NULL;
+                th->timed_out = 1;
+                // woken up once the wheel is unlocked
+                TAILQ_INSERT_TAIL(&expired, th, threads);
+            }
+        }
+        if (timers.tick >= now_tick)
+            break;
+
+        // skip the empty slots, up to now at most: the threads of an upper
+        // level slot are cascaded down once the current tick enters it
+        next_tick = timer_next_tick(1, &level);
+        if (next_tick > now_tick) {
+            timers.tick = now_tick;
+            break;
+        }
+        timers.tick = next_tick;
+        if (level > 0)
+            timer_cascade();
+    }
+    __atomic_store_n(&timers.count, timers.count, __ATOMIC_RELAXED);
+    __atomic_store_n(&timers.next, timer_first(), __ATOMIC_RELAXED);
+    spin_unlock(&timers.lock);
+
+    while ((th = TAILQ_FIRST(&expired)) != NULL) {
+        TAILQ_REMOVE(&expired, th, threads);
+        thread_wake(th);
+    }
+}
+
+/**
+ * returns the entry of descriptor fd, allocated if needed, NULL if fd is out
+ * of the table or on allocation failure.
+ */
+static struct io_fd *io_fd_get(int fd) {
+    struct io_fd *chunk, *new_chunk;
+    unsigned int i;
+
+    if (fd < 0 || fd >= IO_FD_CHUNK * IO_FD_CHUNKS)
+        return NULL;
+
+    chunk = __atomic_load_n(&io_fds[fd / IO_FD_CHUNK], __ATOMIC_ACQUIRE);
+    if (chunk == NULL) {
+        new_chunk = calloc(IO_FD_CHUNK, sizeof(struct io_fd));
+        if (new_chunk == NULL)
+            return NULL;
+        for (i = 0; i < IO_FD_CHUNK; i++)
+            TAILQ_INIT(&new_chunk[i].waiters);
+        // another worker may have allocated it in the meantime
+        if (__atomic_compare_exchange_n(&io_fds[fd / IO_FD_CHUNK], &chunk, new_chunk, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            chunk = new_chunk;
+        else
+            free(new_chunk);
+    }
+
+    return &chunk[fd % IO_FD_CHUNK];
+}
+
+/**
+ * (re)arms the registration of a descriptor whose entry is locked, for events.
+ * a descriptor number may have been closed and reused since it was registered.
+ * returns 0 on success, -1 on failure with errno set.
+ */
+static int io_arm(int fd, struct io_fd *f, uint32_t events) {
+    struct epoll_event ev = { .events = events | EPOLLONESHOT, .data.fd = fd };
+
+    if (f->registered && epoll_ctl(io_epfd, EPOLL_CTL_MOD, fd, &ev) == 0)
+        return 0;
+    if (epoll_ctl(io_epfd, EPOLL_CTL_ADD, fd, &ev) == 0
+        || (errno == EEXIST && epoll_ctl(io_epfd, EPOLL_CTL_MOD, fd, &ev) == 0)) {
+        f->registered = 1;
+        return 0;
+    }
+
+    return -1;
+}
+
+#ifdef THREAD_IO_URING
+/**
+ * passes the requests queued by the threads since the last call to the kernel,
+ * all at once.
+ */
+static void io_ring_flush(void) {
+    if (!io_ring_ok || __atomic_load_n(&io_ring.sq_pending, __ATOMIC_RELAXED) == 0)
+        return;
+
+    spin_lock(&io_ring_sq_lock);
+    if (io_ring.sq_pending > 0 && uring_submit(&io_ring, 0) < 0)
+        perror("io_uring_enter");
+    spin_unlock(&io_ring_sq_lock);
+}
+
+/**
+ * wakes up the threads whose requests completed, returns how many. the
+ * completions are read from memory shared with the kernel, this costs no
+ * system call.
+ */
+static int io_ring_reap(void) {
+    struct thread *woken[IO_EVENTS];
+    struct io_uring_cqe *cqe;
+    int i, n, total = 0;
+
+    if (!io_ring_ok)
+        return 0;
+
+    // the completions that arrive while another worker reaps are left to it:
+    // it checks again once it has unlocked
+    for (;;) {
+        if (uring_peek_cqe(&io_ring) == NULL || !spin_trylock(&io_ring_cq_lock))
+            return total;
+        for (n = 0; n < IO_EVENTS && (cqe = uring_peek_cqe(&io_ring)) != NULL; n++) {
+            struct io_req *req = (struct io_req *)(uintptr_t)cqe->user_data;
+            // the request lives on the stack of its thread, which may return as soon as woken
+            woken[n] = req->th;
+            req->res = cqe->res;
+            uring_cqe_seen(&io_ring);
+        }
+        spin_unlock(&io_ring_cq_lock);
+
+        for (i = 0; i < n; i++)
+            thread_wake(woken[i]);
+        total += n;
+    }
+}
+#endif
+
+/**
+ * waits up to timeout ms (-1 for ever, 0 to only check) for descriptors to be
+ * ready, and wakes up the threads blocked on them for the events that occurred.
+ * the descriptors whose other threads still wait are armed again.
+ * the pending io_uring requests are submitted first, and their completions reaped.
+ */
+static void io_poll(int timeout) {
+    struct epoll_event events[IO_EVENTS];
+    int i, n;
+
+#ifdef THREAD_IO_URING
+    io_ring_flush();
+    // the threads woken by the completions already there must not wait for more
+    if (io_ring_reap() > 0)
+        timeout = 0;
+#endif
+
+    n = epoll_wait(io_epfd, events, IO_EVENTS, timeout);
+    for (i = 0; i < n; i++) {
+        TAILQ_HEAD(io_woken_lifo, thread) woken = TAILQ_HEAD_INITIALIZER(woken);
+        int fd = events[i].data.fd;
+        uint32_t revents = events[i].events | EPOLLERR | EPOLLHUP;
+        uint32_t waited = 0;
+        struct thread *th, *next_th;
+        struct io_fd *f;
+
+#ifdef THREAD_MN
+        // a worker went back to work, see idle_wake()
+        if (fd == io_eventfd) {
+            uint64_t count;
+            if (read(io_eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                perror("read");
+            continue;
+        }
+#endif
+#ifdef THREAD_IO_URING
+        // requests completed
+        if (fd == io_ring_eventfd) {
+            uint64_t count;
+            if (read(io_ring_eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                perror("read");
+            io_ring_reap();
+            continue;
+        }
+#endif
+
+        f = io_fd_get(fd);
+        waitq_lock(&f->waiters);
+        for (th = TAILQ_FIRST(&f->waiters); th != NULL; th = next_th) {
+            next_th = TAILQ_NEXT(th, threads);
+            if (th->io_events & revents) {
+                TAILQ_REMOVE(&f->waiters, th, threads);
+                if (th->deadline != 0)
+                    timeout_cancel(th);
+                TAILQ_INSERT_HEAD(&woken, th, threads);
+            } else {
+                waited |= th->io_events;
+            }
+        }
+        if (waited != 0 && io_arm(fd, f, waited) != 0)
+            perror("epoll_ctl");
+        waitq_unlock(&f->waiters);
+
+        // woken up in the order they blocked, as in waitq_wake_all()
+        while ((th = TAILQ_FIRST(&woken)) != NULL) {
+            TAILQ_REMOVE(&woken, th, threads);
+            thread_wake(th);
+        }
+    }
+}
+
+/**
+ * converts a deadline (see clock_ns(), 0 for none) to a timeout of epoll_wait(),
+ * rounded up to the millisecond.
+ */
+static int io_timeout(uint64_t deadline) {
+    uint64_t now;
+
+    if (deadline == 0)
+        return -1;
+    now = clock_ns();
+    if (deadline <= now)
+        return 0;
+    return (deadline - now + 999999) / 1000000;
+}
+
+/* in the fair policy, each worker runs its threads by increasing virtual
+ * runtime, the CPU time they used weighted by their priority, like the CFS
+ * of Linux. the run queue of a worker is a pairing heap, protected by its
+ * lock in M:N mode.
+ */
+
+/**
+ * adds the CPU time th used since it got the worker, or since the last charge,
+ * to its virtual runtime.
+ */
+static void fair_charge(struct thread *th, uint64_t now) {
+    th->vruntime += (now - th->run_start) * prio_weight[THREAD_PRIO_NORMAL] / prio_weight[th->prio];
+    th->run_start = now;
+}
+
+/**
+ * inserts a runnable thread in the fair run queue of w, which must be locked.
+ * a thread that slept keeps at most FAIR_SLEEP_CREDIT_NS of its lag behind
+ * the others, not to monopolize the worker once woken up.
+ */
+static void fair_insert(struct worker *w, struct thread *th) {
+    if (th->vruntime + FAIR_SLEEP_CREDIT_NS < w->min_vruntime)
+        th->vruntime = w->min_vruntime - FAIR_SLEEP_CREDIT_NS;
+    th->fair_node.key = th->vruntime;
+    heap_insert(&w->fair_runq, &th->fair_node);
+#ifdef THREAD_MN
+    __atomic_store_n(&th->fair_worker, w, __ATOMIC_RELEASE);
+#endif
+}
+
+/**
+ * removes and returns the thread of smallest virtual runtime from the fair
+ * run queue of w, which must be locked. returns NULL if it is empty.
+ */
+static struct thread *fair_take(struct worker *w) {
+    struct heap_node *n = heap_pop(&w->fair_runq);
+    struct thread *th;
+
+    if (n == NULL)
+        return NULL;
+    th = (struct thread *)((char *)n - offsetof(struct thread, fair_node));
+    if (th->vruntime > w->min_vruntime)
+        w->min_vruntime = th->vruntime;
+#ifdef THREAD_MN
+    __atomic_store_n(&th->fair_worker, NULL, __ATOMIC_RELAXED);
+#endif
+
+    return th;
+}
+
+#ifdef THREAD_MN
+/**
+ * wakes up an idle worker, if any, after a thread was made runnable.
+ * the sequentially consistent accesses to nr_idle here and in idle_loop()
+ * ensure that either the pusher sees the idle worker, or the idle worker
+ * sees the pushed thread before sleeping.
+ */
+static void idle_wake(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&nr_idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&idle_mutex);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_mutex);
+    }
+    // the worker blocked in epoll_wait() is not counted in nr_idle
+    if (__atomic_load_n(&io_polling, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(io_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("write");
+    }
+}
+
+/**
+ * steals a thread from the deques of another worker, starting from a random
+ * victim. returns NULL if all deques are empty.
+ */
+static struct thread *runq_steal(struct worker *w) {
+    unsigned int i, start;
+    int retry;
+
+    // xorshift
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    start = w->seed % nr_workers;
+
+    do {
+        retry = 0;
+        for (i = 0; i < nr_workers; i++) {
+            struct worker *victim = &workers[(start + i) % nr_workers];
+            void *th;
+
+            uint32_t mask;
+
+            if (victim == w)
+                continue;
+            if (sched_policy == THREAD_SCHED_FAIR) {
+                if (__atomic_load_n(&victim->fair_runq.root, __ATOMIC_RELAXED) == NULL)
+                    continue;
+                if (!spin_trylock(&victim->fair_lock)) {
+                    retry = 1;
+                    continue;
+                }
+                th = fair_take(victim);
+                spin_unlock(&victim->fair_lock);
+                if (th != NULL)
+                    return th;
+                continue;
+            }
+            // highest priority first, its mask may be stale but never misses a level
+            mask = __atomic_load_n(&victim->runq_mask, __ATOMIC_ACQUIRE);
+            while (mask != 0) {
+                int p = prio_top(mask);
+
+                th = deque_steal(&victim->runq[p]);
+                if (th == DEQUE_ABORT)
+                    retry = 1;
+                else if (th != NULL)
+                    return th;
+                mask &= ~(1U << p);
+            }
+        }
+    } while (retry);
+
+    return NULL;
+}
+
+/**
+ * returns 1 if some worker has a runnable thread in its deques.
+ */
+static int runq_any(void) {
+    unsigned int i;
+
+    for (i = 0; i < nr_workers; i++) {
+        uint32_t mask = __atomic_load_n(&workers[i].runq_mask, __ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&workers[i].fair_runq.root, __ATOMIC_RELAXED) != NULL)
+            return 1;
+        while (mask != 0) {
+            int p = prio_top(mask);
+
+            if (!deque_empty(&workers[i].runq[p]))
+                return 1;
+            mask &= ~(1U << p);
+        }
+    }
+    return 0;
+}
+
+/**
+ * returns the highest priority level with a thread in the deques of the
+ * calling worker, -1 if they are all empty. the levels emptied by thieves are
+ * cleared from its mask on the way; only the worker itself sets them.
+ */
+static int runq_top(void) {
+    struct worker *w = worker_self();
+    uint32_t mask = __atomic_load_n(&w->runq_mask, __ATOMIC_RELAXED);
+
+    while (mask != 0) {
+        int p = prio_top(mask);
+
+        if (!deque_empty(&w->runq[p]))
+            return p;
+        mask &= ~(1U << p);
+        __atomic_and_fetch(&w->runq_mask, ~(1U << p), __ATOMIC_RELAXED);
+    }
+    return -1;
+}
+
+/**
+ * takes a thread from a deque of the calling worker: the newest one, or the
+ * oldest one if fifo is set. returns NULL if the deque is empty.
+ */
+static struct thread *runq_take(struct deque *d, int fifo) {
+    void *th;
+
+    if (!fifo)
+        return deque_take(d);
+    do {
+        th = deque_steal(d);
+    } while (th == DEQUE_ABORT);
+
+    return th;
+}
+#else
+/**
+ * returns 1 if a thread is runnable.
+ */
+static int runq_any(void) {
+    return runnable_mask != 0 || main_worker.fair_runq.root != NULL;
+}
+#endif
+
+/**
+ * makes a thread runnable.
+ * in 1:N mode, inserts it in the runnable FIFO of its priority, at the tail or
+ * at the head. in M:N mode, pushes it on the deque of its priority of the
+ * calling worker, where it is the next thread of that level the worker takes.
+ * blocked threads stay out of the run queue.
+ */
+static void runq_push(struct thread *th, int at_head) {
+    if (th->state == BLOCKED)
+        return;
+#ifdef THREAD_MN
+    struct worker *w = worker_self();
+    // a joining thread on another worker may raise the priority concurrently
+    int p = __atomic_load_n(&th->prio, __ATOMIC_RELAXED);
+
+    (void)at_head;
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        spin_lock(&w->fair_lock);
+        fair_insert(w, th);
+        spin_unlock(&w->fair_lock);
+        idle_wake();
+        return;
+    }
+    __atomic_store_n(&th->queued, 1, __ATOMIC_RELEASE);
+    deque_push(&w->runq[p], th);
+    if (!(w->runq_mask & (1U << p)))
+        __atomic_or_fetch(&w->runq_mask, 1U << p, __ATOMIC_RELEASE);
+    idle_wake();
+#else
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        fair_insert(&main_worker, th);
+    } else {
+        if (at_head)
+            TAILQ_INSERT_HEAD(&runnable_hd[th->prio], th, threads);
+        else
+            TAILQ_INSERT_TAIL(&runnable_hd[th->prio], th, threads);
+        runnable_mask |= 1U << th->prio;
+    }
+    th->flags |= QUEUED;
+#endif
+}
+
+#ifndef THREAD_MN
+/**
+ * removes a thread from the runnable FIFO it waits in.
+ */
+static void runq_remove(struct thread *th) {
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        heap_remove(&main_worker.fair_runq, &th->fair_node);
+    } else {
+        TAILQ_REMOVE(&runnable_hd[th->prio], th, threads);
+        if (TAILQ_EMPTY(&runnable_hd[th->prio]))
+            runnable_mask &= ~(1U << th->prio);
+    }
+    th->flags &= ~QUEUED;
+}
+#endif
+
+/**
+ * takes a runnable thread out of the run queue, to run it right away.
+ * returns 1 on success, 0 if it does not wait in the run queue.
+ * in M:N mode a thread cannot be removed from the middle of a deque: it is
+ * only marked as claimed, and its entry is skipped when it is popped. it is
+ * removed from a fair run queue, under the lock of its worker.
+ */
+static int runq_claim(struct thread *th) {
+#ifdef THREAD_MN
+    struct worker *w;
+    int queued = 1;
+
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        // the thread may move to another worker until its run queue is locked
+        while ((w = __atomic_load_n(&th->fair_worker, __ATOMIC_ACQUIRE)) != NULL) {
+            spin_lock(&w->fair_lock);
+            if (th->fair_worker == w) {
+                heap_remove(&w->fair_runq, &th->fair_node);
+                th->fair_worker = NULL;
+                spin_unlock(&w->fair_lock);
+                return 1;
+            }
+            spin_unlock(&w->fair_lock);
+        }
+        return 0;
+    }
+    return __atomic_compare_exchange_n(&th->queued, &queued, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#else
+    if (!(th->flags & QUEUED))
+        return 0;
+    runq_remove(th);
+    return 1;
+#endif
+}
+
+/**
+ * removes and returns the next thread to run, NULL if no thread is runnable:
+ * the first thread of the highest priority level. if yield is set, the
+ * running thread gives the worker away but stays runnable, and only a thread
+ * of its priority or higher is returned.
+ * in M:N mode, the worker takes the newest thread of its highest level (the
+ * oldest one on a yield, to be fair to the threads that yield), then steals
+ * from the others unless it yields.
+ * in the fair policy, the thread of smallest virtual runtime is returned
+ * instead, whatever the priority of the running thread.
+ */
+static struct thread *runq_pop(int yield) {
+    // the threads whose deadline passed are runnable again
+    timeouts_expire();
+
+    // so are the threads blocked on descriptors that got ready, now and then
+    if (__atomic_load_n(&nr_io_waiting, __ATOMIC_RELAXED) > 0) {
+#ifdef THREAD_IO_URING
+        // the requests queued since the last switch go to the kernel at this
+        // one, all at once, rather than waiting for the next io_poll()
+        io_ring_flush();
+        io_ring_reap();
+#endif
+        if (++worker_self()->io_ticks % IO_POLL_PERIOD == 0)
+            io_poll(0);
+    }
+
+#ifdef THREAD_MN
+    struct worker *w = worker_self();
+    int min = yield ? w->current->prio : THREAD_PRIO_MIN;
+    struct thread *th;
+
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        th = NULL;
+        if (__atomic_load_n(&w->fair_runq.root, __ATOMIC_RELAXED) != NULL) {
+            spin_lock(&w->fair_lock);
+            th = fair_take(w);
+            spin_unlock(&w->fair_lock);
+        }
+        if (th == NULL && !yield)
+            th = runq_steal(w);
+        return th;
+    }
+
+    do {
+        int p;
+
+        // a level emptied by thieves in the meantime is cleared by runq_top()
+        th = NULL;
+        while (th == NULL && (p = runq_top()) >= min)
+            th = runq_take(&w->runq[p], yield);
+        if (th == NULL && !yield)
+            th = runq_steal(w);
+        // skip the entries of threads claimed in the meantime
+    } while (th != NULL && !runq_claim(th));
+
+    return th;
+#else
+    uint32_t mask = runnable_mask;
+    struct thread *th = NULL;
+
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        th = fair_take(&main_worker);
+        if (th != NULL)
+            th->flags &= ~QUEUED;
+        return th;
+    }
+    if (yield)
+        mask &= ~0U << worker_self()->current->prio;
+    if (mask != 0) {
+        th = TAILQ_FIRST(&runnable_hd[prio_top(mask)]);
+        runq_remove(th);
+    }
+
+    return th;
+#endif
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * spins up to idle_spin_ns before the worker blocks in the kernel, until a
+ * thread is runnable or a deadline passed. a thread woken meanwhile then runs
+ * without the system calls of a sleep and a wake-up, at the cost of the CPU
+ * time spent spinning.
+ * returns 1 if the caller should look for a thread again, 0 to block.
+ */
+static int idle_spin(void) {
+    uint64_t now, until, deadline;
+    unsigned int i;
+
+    if (idle_spin_ns == 0)
+        return 0;
+
+    until = clock_ns() + idle_spin_ns;
+    for (i = 1; ; i++) {
+        if (runq_any())
+            return 1;
+#ifdef THREAD_IO_URING
+        if (io_ring_ok && uring_peek_cqe(&io_ring) != NULL)
+            return 1;
+#endif
+        // the rest costs more, it is looked at now and then
+        if (i % IDLE_SPIN_CHECK == 0) {
+            now = clock_ns();
+            deadline = timeout_next();
+            if (deadline != 0 && deadline <= now)
+                return 1;
+            if (now >= until)
+                return 0;
+            if (__atomic_load_n(&nr_io_waiting, __ATOMIC_RELAXED) > 0)
+                io_poll(0);
+        }
+        cpu_relax();
+    }
+}
+
+/**
+ * ends the process when no thread can run anymore: successfully if they all
+ * exited, main included, otherwise the threads left are blocked for good and
+ * the deadlock is reported.
+ */
+__attribute__((noreturn)) static void deadlock_exit(void) {
+    unsigned long nr = __atomic_load_n(&nr_threads, __ATOMIC_SEQ_CST);
+
+    if (nr == 0)
+        exit(EXIT_SUCCESS);
+    fprintf(stderr, "interblocage: %lu thread(s) bloqué(s) sans aucun thread pour les réveiller\n", nr);
+    exit(EXIT_FAILURE);
+}
+
+#ifndef THREAD_MN
+/**
+ * returns the next thread to run like runq_pop(), but when no thread is runnable
+ * and some wait for a deadline or a descriptor, sleeps until the first deadline
+ * passes or a descriptor gets ready.
+ * returns NULL if no thread can become runnable anymore.
+ */
+static struct thread *runq_pop_wait(void) {
+    struct thread *th;
+    uint64_t deadline;
+
+    while ((th = runq_pop(0)) == NULL) {
+        deadline = timeout_next();
+        if (nr_io_waiting == 0 && deadline == 0)
+            break;
+        if (idle_spin())
+            continue;
+
+        if (nr_io_waiting > 0) {
+            io_poll(io_timeout(deadline));
+        } else {
+            struct timespec ts = { deadline / 1000000000ULL, deadline % 1000000000ULL };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+    }
+
+    return th;
+}
+#endif
+
+/**
+ * finishes the switch away from the previous thread of the worker, once running
+ * on another stack: releases it if it was a detached thread that exited,
+ * otherwise lets other workers resume it.
+ * a thread that yielded is only made runnable here, once its context is saved,
+ * so that a thread found in the run queue never has to be waited for.
+ */
+static void switch_finish(void) {
+    struct worker *w = worker_self();
+    struct thread *prev = w->prev;
+
+    if (prev == NULL)
+        return;
+    w->prev = NULL;
+
+    if ((prev->flags & (JOINABLE | DETACHED)) == (JOINABLE | DETACHED)) {
+        thread_put(prev);
+        return;
+    }
+
+#ifdef THREAD_MN
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+#endif
+
+    // insert old thread at tail
+    if (w->requeue)
+        runq_push(prev, 0);
+}
+
+/**
+ * switches the calling worker from prev, its running thread, to next, which
+ * must not run on any worker. prev is put back in the run queue if requeue is set.
+ */
+static void sched_switch(struct thread *prev, struct thread *next, int requeue) {
+    struct worker *w = worker_self();
+
+    if (next == prev)
+        return;
+
+#ifdef THREAD_MN
+    next->on_cpu = 1;
+#endif
+
+    // the virtual runtimes only advance while the threads run
+    if (sched_policy == THREAD_SCHED_FAIR) {
+        uint64_t now = clock_ns();
+
+        if (!(prev->flags & IDLE))
+            fair_charge(prev, now);
+        next->run_start = now;
+    }
+
+    w->current = next;
+    w->prev = prev;
+    w->requeue = requeue;
+    w->nr_switches++;
+    trace(TRACE_SWITCH, next, prev);
+    stats_switch(prev, next);
+
+    // swap to the context of next thread
+    ctx_swap(&prev->ctx, &next->ctx);
+
+    // we may have been resumed by another worker
+    switch_finish();
+}
+
+/**
+ * gives the worker to the next runnable thread, or to its idle thread in
+ * M:N mode if there is none. the running thread is put back at the tail of
+ * the runnable FIFO of its priority if requeue is set, and keeps the worker
+ * if no thread of the same priority or higher is runnable. otherwise it must
+ * be blocked and will be made runnable again by another thread.
+ */
+static void sched_reschedule(int requeue) {
+    struct worker *w = worker_self();
+    struct thread *old_th = w->current;
+    struct thread *next_th;
+
+    // get the next thread in runnable FIFO and remove it from runnable FIFO
+#ifdef THREAD_MN
+    next_th = runq_pop(requeue);
+    // a timeout or a descriptor may have woken the running thread up in the meantime
+    if (old_th->state != BLOCKED)
+        requeue = 1;
+#else
+    next_th = requeue ? runq_pop(1) : runq_pop_wait();
+#endif
+
+    // keep running if no other thread is runnable
+    if (next_th == NULL && requeue)
+        return;
+#ifdef THREAD_MN
+    if (next_th == NULL)
+        next_th = &w->idle_th;
+#else
+    // no thread can ever wake the running one up: leave like the idle workers of M:N mode
+    if (next_th == NULL)
+        deadlock_exit();
+#endif
+
+    sched_switch(old_th, next_th, requeue);
+}
+
+/**
+ * blocks the running thread at the tail of wait queue q, protected by the lock
+ * of guard which must be held and is unlocked here. a queue may be guarded by
+ * another one to share its lock; it is then waited on without a deadline,
+ * as timeouts lock the queue of the thread itself.
+ */
+static void waitq_sleep_on(thread_waitq_t *q, thread_waitq_t *guard) {
+    struct thread *curr_th = worker_self()->current;
+
+    trace(TRACE_BLOCK, curr_th, q);
+    curr_th->state = BLOCKED;
+    curr_th->timed_out = 0;
+    TAILQ_INSERT_TAIL(q, curr_th, threads);
+    waitq_unlock(guard);
+
+    sched_reschedule(0);
+}
+
+/**
+ * blocks the running thread at the tail of a wait queue, which must be locked
+ * and is unlocked here. returns once the thread is made runnable again by
+ * thread_wake() after a waker took it out with waitq_pop(), or once deadline
+ * (see clock_ns(), 0 for none) passed.
+ * returns 0 if the thread was woken up, ETIMEDOUT if it timed out.
+ */
+static int waitq_sleep(thread_waitq_t *q, uint64_t deadline) {
+    struct thread *curr_th = worker_self()->current;
+
+    trace(TRACE_BLOCK, curr_th, q);
+    curr_th->state = BLOCKED;
+    curr_th->timed_out = 0;
+    TAILQ_INSERT_TAIL(q, curr_th, threads);
+    if (deadline != 0) {
+        curr_th->waitq = q;
+        timeout_add(curr_th, deadline);
+    }
+    waitq_unlock(q);
+
+    sched_reschedule(0);
+
+    return curr_th->timed_out ? ETIMEDOUT : 0;
+}
+
+/**
+ * removes the first thread of a locked wait queue, to be woken up with
+ * thread_wake() once the queue is unlocked. returns NULL if the queue is empty.
+ */
+static struct thread *waitq_pop(thread_waitq_t *q) {
+    struct thread *th = TAILQ_FIRST(q);
+
+    if (th != NULL) {
+        TAILQ_REMOVE(q, th, threads);
+        if (th->deadline != 0)
+            timeout_cancel(th);
+    }
+
+    return th;
+}
+
+/**
+ * makes a blocked thread runnable again, at the head of the FIFO of its priority
+ * so that it runs before the other threads of its level.
+ */
+static void thread_wake(struct thread *th) {
+    trace(TRACE_WAKE, th, worker_self()->current);
+#ifdef THREAD_MN
+    // woken up by its own worker before it switched away, see sched_reschedule()
+    if (th == worker_self()->current) {
+        th->state = RUNNABLE;
+        return;
+    }
+#endif
+    // it may not have finished switching away yet
+    wait_off_cpu(th);
+    stats_wake(th);
+    th->state = RUNNABLE;
+    runq_push(th, 1);
+}
+
+/**
+ * empties a locked wait queue, unlocks it and wakes all its threads up.
+ */
+static void waitq_wake_all(thread_waitq_t *q) {
+    TAILQ_HEAD(woken_lifo, thread) woken = TAILQ_HEAD_INITIALIZER(woken);
+    struct thread *th;
+
+    // empty the queue at once, in reverse order
+    while ((th = waitq_pop(q)) != NULL)
+        TAILQ_INSERT_HEAD(&woken, th, threads);
+    waitq_unlock(q);
+
+    // each thread is woken up at the head of the runnable FIFO:
+    // the first one that waited ends up first
+    while ((th = TAILQ_FIRST(&woken)) != NULL) {
+        TAILQ_REMOVE(&woken, th, threads);
+        thread_wake(th);
+    }
+}
+
+/**
+ * finds the address range of the executable code of the program,
+ * which is the first object reported by dl_iterate_phdr().
+ */
+static int text_range(struct dl_phdr_info *info, size_t size, void *data) {
+    int i;
+
+    (void)size;
+    (void)data;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + ph->p_vaddr;
+
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X))
+            continue;
+        if (text_start == 0 || start < text_start)
+            text_start = start;
+        if (start + ph->p_memsz > text_end)
+            text_end = start + ph->p_memsz;
+    }
+
+    // stop after the program
+    return 1;
+}
+
+/**
+ * returns 1 if the code interrupted by a signal, given the context passed to
+ * the handler, belongs to the program. the libraries it calls, the C library
+ * first (malloc, stdio, ...), are not reentrant between the threads of a worker.
+ */
+static int preempt_pc_safe(void *ucontext) {
+#if defined(__x86_64__)
+    uintptr_t pc = ((ucontext_t *)ucontext)->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+    uintptr_t pc = ((ucontext_t *)ucontext)->uc_mcontext.pc;
+#else
+    // unknown context layout, never preempt
+    uintptr_t pc = 0;
+    (void)ucontext;
+#endif
+
+    return pc >= text_start && pc < text_end;
+}
+
+/**
+ * handler of PREEMPT_SIGNAL: the running thread yields if it ran for a whole
+ * time slice. it runs on the stack of the interrupted thread, and returns to
+ * it once the thread is resumed, possibly by another worker.
+ */
+static void preempt_handler(int sig, siginfo_t *info, void *ucontext) {
+    struct worker *w = worker_self();
+    struct thread *curr_th = w->current;
+    int saved_errno = errno;
+
+    (void)sig;
+    (void)info;
+
+    // the thread got the worker after the previous tick, its time slice is not over
+    if (w->nr_switches != w->tick_switches) {
+        w->tick_switches = w->nr_switches;
+        return;
+    }
+
+    // in a critical section of the scheduler: yield at its end
+    if (curr_th->preempt_off > 0) {
+        curr_th->preempt_pending = 1;
+        return;
+    }
+
+    // in a library: try again at the next tick
+    if (!preempt_pc_safe(ucontext))
+        return;
+
+    preempt_yield(curr_th);
+    errno = saved_errno;
+}
+
+/**
+ * creates the timer of the worker running on the calling kernel thread. it
+ * counts the CPU time of the kernel thread, so that a worker which sleeps
+ * gets no tick, and is armed by preempt_timer_arm().
+ */
+static void preempt_timer_init(struct worker *w) {
+    struct sigevent sev = { 0 };
+
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = PREEMPT_SIGNAL;
+    sev.sigev_notify_thread_id = gettid();
+    w->has_timer = timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &w->timer) == 0;
+}
+
+/**
+ * arms the timer of a worker to tick every quantum_us microseconds, or disarms it if 0.
+ * returns 0 on success, -1 on failure.
+ */
+static int preempt_timer_arm(struct worker *w, unsigned int quantum_us) {
+    struct itimerspec its;
+
+    if (!w->has_timer)
+        return quantum_us > 0 ? -1 : 0;
+
+    its.it_interval.tv_sec = quantum_us / 1000000;
+    its.it_interval.tv_nsec = (quantum_us % 1000000) * 1000L;
+    its.it_value = its.it_interval;
+
+    return timer_settime(w->timer, 0, &its, NULL);
+}
+
+/* configurer la préemption des threads.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_preempt_config(unsigned int quantum_us) {
+    static int installed = 0;
+    int ret = 0;
+
+    // the handler is installed on first use
+    if (quantum_us > 0 && !installed) {
+        struct sigaction sa;
+
+        dl_iterate_phdr(text_range, NULL);
+
+        sa.sa_sigaction = preempt_handler;
+        sigemptyset(&sa.sa_mask);
+        // the handler switches to other threads, which must stay preemptible
+        // until it returns: the signal is not blocked while it runs
+        sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+        if (sigaction(PREEMPT_SIGNAL, &sa, NULL) != 0)
+            return -1;
+        installed = 1;
+    }
+
+#ifdef THREAD_MN
+    unsigned int i;
+
+    // the workers not started yet arm their timer in worker_main()
+    pthread_mutex_lock(&preempt_mutex);
+    preempt_quantum = quantum_us;
+    for (i = 0; i < nr_workers; i++) {
+        if (workers[i].has_timer && preempt_timer_arm(&workers[i], quantum_us) != 0)
+            ret = -1;
+    }
+    pthread_mutex_unlock(&preempt_mutex);
+#else
+    preempt_quantum = quantum_us;
+    ret = preempt_timer_arm(&main_worker, quantum_us);
+#endif
+
+    return ret;
+}
+
+/* configurer l'attente des threads noyau sans thread à exécuter.
+ * renvoie 0.
+ */
+int thread_idle_config(unsigned int spin_us) {
+    __atomic_store_n(&idle_spin_ns, (uint64_t)spin_us * 1000, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* configurer la politique d'ordonnancement, tant qu'aucun thread n'attend
+ * dans la file des threads prêts.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_sched_config(int policy) {
+    if (policy != THREAD_SCHED_FIFO && policy != THREAD_SCHED_FAIR)
+        return -1;
+    if (policy == sched_policy)
+        return 0;
+
+#ifdef THREAD_MN
+    // the other workers may be pushing threads in their run queues
+    if (workers_started)
+        return -1;
+#else
+    if (runq_any())
+        return -1;
+#endif
+    sched_policy = policy;
+    worker_self()->current->run_start = clock_ns();
+
+    return 0;
+}
+
+#ifdef THREAD_MN
+/**
+ * loop run by the idle thread of each worker: runs the runnable threads and
+ * sleeps while there are none. when every worker is idle and no thread is
+ * runnable, no thread can make progress anymore and the process exits,
+ * as in 1:N mode when the last runnable thread exits, see deadlock_exit().
+ */
+static void idle_loop(void) {
+    for (;;) {
+        struct thread *next_th;
+        uint64_t deadline;
+
+        // finish the switch from the thread that made us idle
+        switch_finish();
+
+        next_th = runq_pop(0);
+        if (next_th != NULL) {
+            sched_switch(&worker_self()->idle_th, next_th, 0);
+            continue;
+        }
+
+#ifdef THREAD_IO_URING
+        // the requests queued here would otherwise wait for the next poll
+        io_ring_flush();
+#endif
+        // not counted in nr_idle while spinning, the wakers save a signal
+        if (idle_spin())
+            continue;
+
+        // one idle worker waits for the descriptors, until a thread is pushed
+        deadline = timeout_next();
+        if (__atomic_load_n(&nr_io_waiting, __ATOMIC_RELAXED) > 0
+            && !__atomic_exchange_n(&io_polling, 1, __ATOMIC_SEQ_CST)) {
+            if (!runq_any())
+                io_poll(io_timeout(deadline));
+            __atomic_store_n(&io_polling, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        // nothing to steal: sleep until a thread is pushed, or until the first deadline
+        pthread_mutex_lock(&idle_mutex);
+        deadline = timeout_next();
+        if (__atomic_add_fetch(&nr_idle, 1, __ATOMIC_SEQ_CST) == (workers_started ? nr_workers : 1)
+            && !runq_any() && deadline == 0 && __atomic_load_n(&nr_io_waiting, __ATOMIC_SEQ_CST) == 0) {
+            pthread_mutex_unlock(&idle_mutex);
+            deadlock_exit();
+        }
+        if (!runq_any()) {
+            if (deadline != 0) {
+                struct timespec ts = { deadline / 1000000000ULL, deadline % 1000000000ULL };
+                pthread_cond_timedwait(&idle_cond, &idle_mutex, &ts);
+            } else {
+                pthread_cond_wait(&idle_cond, &idle_mutex);
+            }
+        }
+        __atomic_sub_fetch(&nr_idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&idle_mutex);
+    }
+}
+
+/**
+ * entry point of the kernel threads of the pool: their idle thread runs
+ * on the stack of the kernel thread.
+ */
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+
+    self_worker = w;
+    w->current = &w->idle_th;
+    w->idle_th.on_cpu = 1;
+
+    // the timer ticks right away if preemption is enabled
+    pthread_mutex_lock(&preempt_mutex);
+    preempt_timer_init(w);
+    preempt_timer_arm(w, preempt_quantum);
+    pthread_mutex_unlock(&preempt_mutex);
+
+    idle_loop();
+    return NULL;
+}
+
+/**
+ * starts the kernel threads of the pool, worker 0 being the calling one.
+ */
+static void workers_start(void) {
+    unsigned int i;
+
+    workers_started = 1;
+    for (i = 1; i < nr_workers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * sets up the workers, the number of kernel threads is given by the environment
+ * variable THREAD_WORKERS and defaults to the number of online processors.
+ */
+static void workers_init(void) {
+    const char *env_workers = getenv("THREAD_WORKERS");
+    long n = env_workers ? strtol(env_workers, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int i;
+    int p;
+    pthread_condattr_t attr;
+
+    // idle workers sleep until the deadlines of CLOCK_MONOTONIC
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&idle_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    nr_workers = n > 0 ? n : 1;
+    workers = calloc(nr_workers, sizeof(struct worker));
+    if (workers == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < nr_workers; i++) {
+        TAILQ_INIT(&workers[i].cached_hd);
+        for (p = 0; p < NR_PRIO; p++) {
+            if (deque_init(&workers[i].runq[p]) != 0) {
+                perror("malloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        workers[i].seed = 2463534242U + i;
+        workers[i].idle_th.flags = IDLE;
+        workers[i].idle_th.state = BLOCKED;
+        // the idle thread only runs scheduler code
+        workers[i].idle_th.preempt_off = 1;
+    }
+
+    // worker 0 runs main() on the stack of the process, its idle thread needs its own
+    struct thread *idle_th = &workers[0].idle_th;
+    idle_th->stack_size = default_stack_size;
+    idle_th->stack = stack_alloc(idle_th->stack_size);
+    if (idle_th->stack == NULL) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    idle_th->valgrind_stackid = VALGRIND_STACK_REGISTER(idle_th->stack, idle_th->stack + idle_th->stack_size);
+    ctx_make(&idle_th->ctx, idle_th->stack, idle_th->stack_size, idle_loop);
+
+    self_worker = &workers[0];
+}
+#endif
+
+/**
+ * frees the memory allocated to the abandoned and cached threads
+ * when main() returns/exits.
+ */
+__attribute__ ((destructor)) void free_thread(void) {
+    // the process exits, the scheduler must not run anymore
+    preempt_disable();
+
+    // release the last detached thread that exited
+    switch_finish();
+
+    if (trace_on)
+        thread_trace_config(NULL);
+    if (stack_profile_on)
+        thread_stack_config(NULL);
+
+    struct worker *w = worker_self();
+
+    // in M:N mode the other workers may still run, only the cache of this one is freed
+#ifndef THREAD_MN
+
+    // free the abandoned threads
+    while (!TAILQ_EMPTY(&abandoned_hd)) {
+        struct thread *th = TAILQ_FIRST(&abandoned_hd);
+        TAILQ_REMOVE(&abandoned_hd, th, threads);
+        thread_free(th);
+    }
+#endif
+
+    // free the cached threads
+    while (!TAILQ_EMPTY(&w->cached_hd)) {
+        struct thread *th = TAILQ_FIRST(&w->cached_hd);
+        TAILQ_REMOVE(&w->cached_hd, th, threads);
+        thread_free(th);
+    }
+    w->cached_count = 0;
+
+    // in M:N mode the husks are left to the system: other workers may still pop them
+}
+
+/**
+ * initializes the main thread (and context) and adds it to runnable FIFO
+ */
+__attribute__((constructor)) void init_thread(void) {
+    page_size = sysconf(_SC_PAGESIZE);
+    default_stack_size = stack_round(STACK_SIZE);
+
+#ifdef THREAD_MN
+    workers_init();
+    main_th.on_cpu = 1;
+#else
+    TAILQ_INIT(&main_worker.cached_hd);
+    for (int p = 0; p < NR_PRIO; p++)
+        TAILQ_INIT(&runnable_hd[p]);
+#endif
+
+    // set the flag and priority of main context
+    main_th.flags |= MAIN;
+    main_th.state = RUNNABLE;
+    main_th.prio = THREAD_PRIO_NORMAL;
+    TAILQ_INIT(&main_th.joiners);
+
+    // init the context for the main thread
+    ctx_init(&main_th.ctx);
+
+    // add main thread to runnable fifo
+    worker_self()->current = &main_th;
+    stats_init();
+
+    // warm up the thread cache, the defaults can be overridden from the environment
+    const char *env_max = getenv("THREAD_CACHE_MAX");
+    const char *env_prewarm = getenv("THREAD_CACHE_PREWARM");
+    thread_cache_config(env_max ? strtoul(env_max, NULL, 10) : THREAD_CACHE_MAX,
+                        env_prewarm ? strtoul(env_prewarm, NULL, 10) : THREAD_CACHE_PREWARM);
+
+    // the preemption is opt-in, from the environment or thread_preempt_config()
+    const char *env_preempt = getenv("THREAD_PREEMPT_US");
+    unsigned int quantum = env_preempt ? strtoul(env_preempt, NULL, 10) : THREAD_PREEMPT_US;
+    preempt_timer_init(worker_self());
+    if (quantum > 0)
+        thread_preempt_config(quantum);
+
+    const char *env_spin = getenv("THREAD_IDLE_SPIN_US");
+    thread_idle_config(env_spin ? strtoul(env_spin, NULL, 10) : THREAD_IDLE_SPIN_US);
+
+    const char *env_trace = getenv("THREAD_TRACE");
+    if (env_trace != NULL && *env_trace != '\0')
+        thread_trace_config(env_trace);
+
+    const char *env_stack = getenv("THREAD_STACK_PROFILE");
+    if (env_stack != NULL && *env_stack != '\0')
+        thread_stack_config(env_stack);
+
+    const char *env_sched = getenv("THREAD_SCHED");
+    if (env_sched != NULL)
+        thread_sched_config(strcmp(env_sched, "fair") == 0 ? THREAD_SCHED_FAIR : THREAD_SCHED_FIFO);
+    else
+        thread_sched_config(THREAD_SCHED);
+}
+
+/* terminer le thread courant en renvoyant la valeur de retour retval.
+ * cette fonction ne retourne jamais.
+ *
+ * L'attribut noreturn aide le compilateur à optimiser le code de
+ * l'application (élimination de code mort). Attention à ne pas mettre
+ * cet attribut dans votre interface tant que votre thread_exit()
+ * n'est pas correctement implémenté (il ne doit jamais retourner).
+ */
+void thread_exit(void *retval) {
+    struct worker *w = worker_self();
+    struct thread *curr_th = w->current;
+    struct thread *master, *next_th;
+
+    // the destructors may still use the library
+    keys_destroy(curr_th);
+    trace(TRACE_EXIT, curr_th, NULL);
+    __atomic_sub_fetch(&nr_threads, 1, __ATOMIC_RELAXED);
+
+    // the thread never runs again, the next one enables preemption back
+    preempt_disable();
+
+    if (curr_th->flags & PAINTED)
+        stack_profile_record(curr_th);
+
+    // set retval in the thread structure
+    curr_th->retval = retval;
+
+    // publish the exit, and get the thread blocked in joining us if any
+    master = __atomic_exchange_n(&curr_th->master, EXITED_MASTER, __ATOMIC_ACQ_REL);
+    if (master == DETACHED_MASTER) {
+        curr_th->flags |= DETACHED;
+        master = NULL;
+    }
+
+#ifndef THREAD_MN
+    // add it to abandoned FIFO, unless nobody will join it
+    if (!(curr_th->flags & (MAIN | DETACHED))) {
+        TAILQ_INSERT_TAIL(&abandoned_hd, curr_th, threads);
+    }
+#endif
+
+    // make the thread joinable; a detached thread is released by the next thread, off its stack
+    curr_th->flags |= JOINABLE;
+
+    // wake it up, unless its join timed out in the meantime
+    if (master != NULL) {
+        waitq_lock(&curr_th->joiners);
+        master = waitq_pop(&curr_th->joiners);
+        waitq_unlock(&curr_th->joiners);
+        if (master != NULL)
+            thread_wake(master);
+    }
+
+    // resume context of the next thread in runnable FIFO
+#ifdef THREAD_MN
+    next_th = runq_pop(0);
+    // or of the idle thread of the worker if there is none
+    if (next_th == NULL)
+        next_th = &w->idle_th;
+#else
+    next_th = runq_pop_wait();
+#endif
+
+    if (next_th != NULL) {
+        sched_switch(curr_th, next_th, 0);
+    } else if (!(curr_th->flags & MAIN) && __atomic_load_n(&nr_threads, __ATOMIC_SEQ_CST) == 0) {
+        // the last thread isnt the main thread, which exited before:
+        // restore its context to clean up with destructor
+        w->current = &main_th;
+        w->prev = curr_th;
+        w->requeue = 0;
+        ctx_set(&main_th.ctx);
+    }
+
+#ifndef THREAD_MN
+    // exit() frees the abandoned threads, and we still run on the stack of this one
+    if (!(curr_th->flags & (MAIN | DETACHED)))
+        TAILQ_REMOVE(&abandoned_hd, curr_th, threads);
+#endif
+    deadlock_exit();
+}
+
+void thread_runner(void) {
+    // release the detached thread we may have switched from
+    switch_finish();
+    preempt_enable();
+
+    // get the thread running on this worker
+    struct thread *curr_th = worker_self()->current;
+
+    // call the entry function of the thread and pass the return value to thread_exit
+    thread_exit(curr_th->func(curr_th->funcarg));
+}
+
+/* recuperer l'identifiant du thread courant.
+ */
+thread_t thread_self(void) {
+    // get the thread running on this worker
+    return (thread_t)worker_self()->current;
+}
+
+/*      Attributs de threads      */
+
+int thread_attr_init(thread_attr_t *attr) {
+    if (attr == NULL)
+        return -1;
+
+    attr->stacksize = STACK_SIZE;
+    attr->priority = THREAD_PRIO_NORMAL;
+    attr->detachstate = THREAD_CREATE_JOINABLE;
+    return 0;
+}
+
+int thread_attr_destroy(thread_attr_t *attr) {
+    return attr == NULL ? -1 : 0;
+}
+
+int thread_attr_setstacksize(thread_attr_t *attr, size_t stacksize) {
+    if (attr == NULL || stacksize < THREAD_STACK_MIN)
+        return -1;
+
+    attr->stacksize = stacksize;
+    return 0;
+}
+
+int thread_attr_getstacksize(const thread_attr_t *attr, size_t *stacksize) {
+    if (attr == NULL || stacksize == NULL)
+        return -1;
+
+    *stacksize = attr->stacksize;
+    return 0;
+}
+
+int thread_attr_setpriority(thread_attr_t *attr, int priority) {
+    if (attr == NULL || priority < THREAD_PRIO_MIN || priority > THREAD_PRIO_MAX)
+        return -1;
+
+    attr->priority = priority;
+    return 0;
+}
+
+int thread_attr_getpriority(const thread_attr_t *attr, int *priority) {
+    if (attr == NULL || priority == NULL)
+        return -1;
+
+    *priority = attr->priority;
+    return 0;
+}
+
+int thread_attr_setdetachstate(thread_attr_t *attr, int detachstate) {
+    if (attr == NULL || (detachstate != THREAD_CREATE_JOINABLE && detachstate != THREAD_CREATE_DETACHED))
+        return -1;
+
+    attr->detachstate = detachstate;
+    return 0;
+}
+
+int thread_attr_getdetachstate(const thread_attr_t *attr, int *detachstate) {
+    if (attr == NULL || detachstate == NULL)
+        return -1;
+
+    *detachstate = attr->detachstate;
+    return 0;
+}
+
+/* creer un nouveau thread qui va exécuter la fonction func avec l'argument funcarg.
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_create(thread_t *newthread, void *(*func)(void *), void *funcarg) {
+    return thread_create_attr(newthread, NULL, func, funcarg);
+}
+
+/* creer un nouveau thread avec les attributs attr (ou ceux par défaut si attr est NULL).
+ * renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_create_attr(thread_t *newthread, const thread_attr_t *attr, void *(*func)(void *), void *funcarg) {
+    size_t stack_size = default_stack_size;
+    int prio = THREAD_PRIO_NORMAL;
+    int detached = 0;
+
+    if (attr != NULL) {
+        stack_size = stack_round(attr->stacksize);
+        prio = attr->priority;
+        detached = attr->detachstate == THREAD_CREATE_DETACHED;
+    }
+
+    preempt_disable();
+
+    // get a struct thread instance and its stack for the new thread
+    struct thread *thn = thread_get(stack_size);
+    if (thn == NULL) {
+        preempt_enable();
+        return -1;
+    }
+
+    thn->flags = detached ? DETACHED : 0U;
+    thn->func = func;
+    thn->funcarg = funcarg;
+    thn->retval = NULL;
+    thn->state = RUNNABLE;
+    thn->prio = prio;
+    // a new thread starts level with the threads of the worker, see fair_insert()
+    thn->vruntime = worker_self()->min_vruntime;
+    thn->master = NULL;
+    // a fresh struct may reuse freed memory, see waitq_pop()
+    thn->deadline = 0;
+    TAILQ_INIT(&thn->joiners);
+    thn->joiners.lock = 0;
+    thn->wait_join = NULL;
+    thn->wait_mutex = NULL;
+    // enabled by thread_runner() once the thread runs
+    thn->preempt_off = 1;
+    thn->preempt_pending = 0;
+    stats_create(thn);
+    __atomic_add_fetch(&nr_threads, 1, __ATOMIC_RELAXED);
+#ifdef THREAD_MN
+    thn->on_cpu = 0;
+    thn->queued = 0;
+#endif
+
+    // set the thread id as the pointer to its struct thread instance
+    *newthread = (thread_t)thn;
+
+    // measure its stack usage at exit, see thread_stack_config()
+    if (__builtin_expect(__atomic_load_n(&stack_profile_on, __ATOMIC_RELAXED), 0)) {
+        stack_paint(thn);
+        thn->flags |= PAINTED;
+    }
+
+    // set up the context of the new thread
+    // set the thread runner as entry point
+    ctx_make(&thn->ctx, thn->stack, thn->stack_size, thread_runner);
+
+#ifdef THREAD_MN
+    // the kernel threads of the pool are started along with the first thread
+    if (!workers_started)
+        workers_start();
+#endif
+
+    // add new thread to the runnable FIFO of its priority
+    trace(TRACE_CREATE, thn, worker_self()->current);
+    runq_push(thn, 0);
+
+    preempt_enable();
+    return 0;
+}
+
+/* passer la main à un autre thread.
+ */
+int thread_yield(void) {
+    trace(TRACE_YIELD, worker_self()->current, NULL);
+    preempt_disable();
+    sched_reschedule(1);
+    preempt_enable();
+
+    return 0;
+}
+
+/* Cette fonction permet de passer la main au thread t*/
+int thread_yield_to(struct thread * t) {
+    struct thread *old_th = worker_self()->current;
+
+    trace(TRACE_YIELD, old_th, t);
+    preempt_disable();
+
+    // t can only be resumed if it waits in the run queue, remove it from there
+    if (runq_claim(t)) {
+        // swap to the context of t, inserting old thread at tail
+        sched_switch(old_th, t, 1);
+    } else {
+        sched_reschedule(1);
+    }
+
+    preempt_enable();
+    return 0;
+}
+
+/* changer la priorité d'un thread, prise en compte à son prochain passage dans
+ * la file des threads prêts. renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_setpriority(thread_t thread, int priority) {
+    struct thread *th = (struct thread *)thread;
+
+    if (th == NULL || priority < THREAD_PRIO_MIN || priority > THREAD_PRIO_MAX)
+        return -1;
+
+    preempt_disable();
+#ifdef THREAD_MN
+    // a thread waiting in a deque stays in the one of its former priority
+    __atomic_store_n(&th->prio, priority, __ATOMIC_RELAXED);
+#else
+    if (th->flags & QUEUED) {
+        runq_remove(th);
+        th->prio = priority;
+        runq_push(th, 0);
+    } else {
+        th->prio = priority;
+    }
+#endif
+    preempt_enable();
+
+    return 0;
+}
+
+/* lire la priorité d'un thread. renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_getpriority(thread_t thread, int *priority) {
+    struct thread *th = (struct thread *)thread;
+
+    if (th == NULL || priority == NULL)
+        return -1;
+
+    *priority = __atomic_load_n(&th->prio, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*      Données propres aux threads      */
+
+
+/**
+ * returns the slot of the value of key in th, NULL if it was never set.
+ */
+static inline void **key_slot(struct thread *th, thread_key_t key) {
+    if (key < THREAD_KEYS_INLINE)
+        return &th->specific[key];
+    key -= THREAD_KEYS_INLINE;
+    return key < th->specific_ext_size ? &th->specific_ext[key] : NULL;
+}
+
+/**
+ * calls the destructors of the keys on the values of an exiting thread, until
+ * none is left or after THREAD_DESTRUCTOR_ITERATIONS rounds, then clears all
+ * its values for the next thread_create() of the struct.
+ */
+static void keys_destroy(struct thread *th) {
+    unsigned int n = __atomic_load_n(&nr_keys, __ATOMIC_ACQUIRE);
+    void (*destructor)(void *);
+    void **slot, *value;
+    unsigned int i, round;
+    int again = 1;
+
+    // no key was ever created
+    if (n == 0)
+        return;
+
+    for (round = 0; again && round < THREAD_DESTRUCTOR_ITERATIONS; round++) {
+        again = 0;
+        for (i = 0; i < n; i++) {
+            // a destructor may set a value and grow specific_ext
+            slot = key_slot(th, i);
+            if (slot == NULL)
+                break;
+            value = *slot;
+            destructor = __atomic_load_n(&key_destructors[i], __ATOMIC_RELAXED);
+            if (value == NULL || destructor == NULL)
+                continue;
+            *slot = NULL;
+            destructor(value);
+            again = 1;
+        }
+    }
+
+    memset(th->specific, 0, sizeof(th->specific));
+    if (th->specific_ext != NULL)
+        memset(th->specific_ext, 0, th->specific_ext_size * sizeof(void *));
+}
+
+/* créer une clé de données propres aux threads.
+ * renvoie 0 en cas de succès, EAGAIN s'il n'y a plus de clé.
+ */
+int thread_key_create(thread_key_t *key, void (*destructor)(void *)) {
+    unsigned int n = __atomic_load_n(&nr_keys, __ATOMIC_RELAXED);
+
+    if (key == NULL)
+        return EINVAL;
+
+    // a deleted key keeps its values in the threads that set it: it cannot be
+    // given again, whereas a new key must read NULL in all threads
+    do {
+        if (n >= THREAD_KEYS_MAX)
+            return EAGAIN;
+    } while (!__atomic_compare_exchange_n(&nr_keys, &n, n + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    __atomic_store_n(&key_destructors[n], destructor, __ATOMIC_RELAXED);
+    *key = n;
+    return 0;
+}
+
+/* détruire une clé, sans appeler son destructeur.
+ * renvoie 0 en cas de succès, EINVAL si la clé n'existe pas.
+ */
+int thread_key_delete(thread_key_t key) {
+    if (key >= __atomic_load_n(&nr_keys, __ATOMIC_ACQUIRE)
+        || __atomic_exchange_n(&key_deleted[key], 1, __ATOMIC_RELAXED))
+        return EINVAL;
+
+    __atomic_store_n(&key_destructors[key], NULL, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* lire la valeur du thread courant pour une clé.
+ */
+void *thread_getspecific(thread_key_t key) {
+    struct thread *curr_th = worker_self()->current;
+
+    // a single load for the first keys
+    if (key < THREAD_KEYS_INLINE)
+        return curr_th->specific[key];
+    key -= THREAD_KEYS_INLINE;
+    return key < curr_th->specific_ext_size ? curr_th->specific_ext[key] : NULL;
+}
+
+/* changer la valeur du thread courant pour une clé.
+ * renvoie 0 en cas de succès, EINVAL si la clé n'existe pas, ENOMEM si la
+ * place manque.
+ */
+int thread_setspecific(thread_key_t key, const void *value) {
+    struct thread *curr_th = worker_self()->current;
+    unsigned int size, ext = key - THREAD_KEYS_INLINE;
+    void **values;
+
+    if (key >= __atomic_load_n(&nr_keys, __ATOMIC_ACQUIRE) || key_deleted[key])
+        return EINVAL;
+
+    if (key < THREAD_KEYS_INLINE) {
+        curr_th->specific[key] = (void *)value;
+        return 0;
+    }
+
+    // the other values are in an array grown by doubling, kept with the
+    // struct in the thread cache
+    if (ext >= curr_th->specific_ext_size) {
+        size = curr_th->specific_ext_size ? curr_th->specific_ext_size : THREAD_KEYS_INLINE;
+        while (size <= ext)
+            size *= 2;
+        values = realloc(curr_th->specific_ext, size * sizeof(void *));
+        if (values == NULL)
+            return ENOMEM;
+        memset(values + curr_th->specific_ext_size, 0, (size - curr_th->specific_ext_size) * sizeof(void *));
+        curr_th->specific_ext = values;
+        curr_th->specific_ext_size = size;
+    }
+    curr_th->specific_ext[ext] = (void *)value;
+
+    return 0;
+}
+
+/*      Détection des interblocages      */
+
+
+/**
+ * returns the thread th waits for without deadline, the one it joins or the
+ * locker of the mutex it waits for, NULL if none.
+ */
+static struct thread *deadlock_next(struct thread *th) {
+    struct thread *next = __atomic_load_n(&th->wait_join, DEADLOCK_ORDER);
+    thread_mutex_t *mutex;
+
+    if (next != NULL)
+        return next;
+    mutex = __atomic_load_n(&th->wait_mutex, DEADLOCK_ORDER);
+    if (mutex == NULL)
+        return NULL;
+    // thread_mutex_unlock() may have handed it the mutex already
+    next = __atomic_load_n((struct thread **)&mutex->locker, DEADLOCK_ORDER);
+    return next != th ? next : NULL;
+}
+
+/**
+ * follows the chain of waits from owner, which the running thread is about to
+ * wait for, over at most DEADLOCK_CHAIN_MAX threads and without any lock.
+ * the wait of the running thread must already be published: of two threads
+ * closing a cycle at once on different workers, at least one of them sees it.
+ * returns 1 and reports the cycle to the hook if the chain comes back to the
+ * running thread.
+ */
+static int deadlock_check(struct thread *owner) {
+    struct thread *curr_th = worker_self()->current;
+    struct thread *th = owner;
+    thread_t cycle[DEADLOCK_CHAIN_MAX];
+    int n = 0;
+
+    cycle[n++] = (thread_t)curr_th;
+    while (th != curr_th) {
+        if (th == NULL || n == DEADLOCK_CHAIN_MAX)
+            return 0;
+        cycle[n++] = (thread_t)th;
+        th = deadlock_next(th);
+    }
+
+#ifdef THREAD_MN
+    int i;
+
+    // the threads of the chain may have been woken up while it was followed:
+    // they still all wait for the next one in a deadlock
+    for (i = 1; i < n; i++) {
+        if (deadlock_next((struct thread *)cycle[i]) != (struct thread *)cycle[(i + 1) % n])
+            return 0;
+    }
+#endif
+
+    if (deadlock_hook != NULL)
+        deadlock_hook(cycle, n);
+    return 1;
+}
+
+/* configurer la détection des interblocages.
+ * renvoie 0.
+ */
+int thread_deadlock_config(thread_deadlock_hook_t hook) {
+    __atomic_store_n(&deadlock_hook, hook, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * waits for a thread to exit until deadline (see clock_ns(), 0 for none),
+ * then releases it. returns ETIMEDOUT if it still runs, -1 with errno set to
+ * EDEADLK if it waits for the running thread, see deadlock_check().
+ */
+static int join(struct thread *th, void **retval, uint64_t deadline) {
+    struct thread *curr_th = worker_self()->current;
+    struct thread *master = NULL;
+    int ret = 0;
+
+    // a detached thread cannot be joined
+    if (th->flags & DETACHED) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    preempt_disable();
+
+    // only the waits without deadline can deadlock
+    if (deadline == 0) {
+        __atomic_store_n(&curr_th->wait_join, th, DEADLOCK_ORDER);
+        if (deadlock_check(th)) {
+            curr_th->wait_join = NULL;
+            preempt_enable();
+            errno = EDEADLK;
+            return -1;
+        }
+    }
+
+    // block until the thread exits, unless it already did: registering as its
+    // master fails once thread_exit() has replaced it with EXITED_MASTER.
+    // thread_exit() takes us out of its joiners queue, locked until we wait in it
+    waitq_lock(&th->joiners);
+    if (__atomic_compare_exchange_n(&th->master, &master, curr_th, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+#ifndef THREAD_MN
+        // the joined thread inherits our priority if it is higher, and runs
+        // next if it waits in the run queue
+        if (th->flags & QUEUED) {
+            runq_remove(th);
+            if (th->prio < curr_th->prio)
+                th->prio = curr_th->prio;
+            runq_push(th, 1);
+        } else if (th->prio < curr_th->prio) {
+            th->prio = curr_th->prio;
+        }
+        ret = waitq_sleep(&th->joiners, deadline);
+#else
+        // the joined thread inherits our priority if it is higher, and runs
+        // right away if it waits in a deque
+        if (__atomic_load_n(&th->prio, __ATOMIC_RELAXED) < curr_th->prio)
+            __atomic_store_n(&th->prio, curr_th->prio, __ATOMIC_RELAXED);
+        if (deadline == 0 && runq_claim(th)) {
+            trace(TRACE_BLOCK, curr_th, &th->joiners);
+            curr_th->state = BLOCKED;
+            TAILQ_INSERT_TAIL(&th->joiners, curr_th, threads);
+            waitq_unlock(&th->joiners);
+            sched_switch(curr_th, th, 0);
+        } else {
+            ret = waitq_sleep(&th->joiners, deadline);
+        }
+#endif
+        curr_th->wait_join = NULL;
+        // it can still be joined later, unless it exited in the meantime
+        if (ret == ETIMEDOUT && __sync_bool_compare_and_swap(&th->master, curr_th, NULL)) {
+            preempt_enable();
+            return ETIMEDOUT;
+        }
+    } else {
+        waitq_unlock(&th->joiners);
+        curr_th->wait_join = NULL;
+        // detached by thread_detach() while it runs
+        if (master == DETACHED_MASTER) {
+            preempt_enable();
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+#ifndef THREAD_MN
+    // remove the thread from abandonned FIFO
+    if (!(th->flags & MAIN)) {
+        TAILQ_REMOVE(&abandoned_hd, th, threads);
+    }
+#endif
+
+    // if retval is not NULL, get the return val set by thread_exit
+    if (retval)
+        *retval = th->retval;
+
+    // recycle the thread if not main thread, once off its stack
+    if (!(th->flags & MAIN)) {
+        wait_off_cpu(th);
+        thread_put(th);
+    }
+
+    preempt_enable();
+    return 0;
+}
+
+/* attendre la fin d'exécution d'un thread.
+ * la valeur renvoyée par le thread est placée dans *retval.
+ * si retval est NULL, la valeur de retour est ignorée.
+ */
+int thread_join(thread_t thread, void **retval) {
+    // cast the thread ID back to (struct thread *)
+    return join((struct thread *)thread, retval, 0);
+}
+
+int thread_timedjoin(thread_t thread, void **retval, const struct timespec *abstime) {
+    if (abstime == NULL)
+        return -1;
+
+    return join((struct thread *)thread, retval, deadline_from_abstime(abstime));
+}
+
+/* détacher un thread, libéré dès qu'il se termine ou tout de suite s'il est
+ * déjà terminé. renvoie 0 en cas de succès, -1 en cas d'erreur.
+ */
+int thread_detach(thread_t thread) {
+    struct thread *th = (struct thread *)thread;
+    struct thread *master = NULL;
+
+    // the struct of the main thread does not belong to the library
+    if (th == NULL || (th->flags & (MAIN | DETACHED)))
+        return -1;
+
+    preempt_disable();
+
+    // released by the next thread once it exits, see thread_exit()
+    if (__atomic_compare_exchange_n(&th->master, &master, DETACHED_MASTER, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        preempt_enable();
+        return 0;
+    }
+    // already detached, or some thread joins it
+    if (master != EXITED_MASTER) {
+        preempt_enable();
+        return -1;
+    }
+
+    // it already exited: release it as thread_join() would
+#ifndef THREAD_MN
+    TAILQ_REMOVE(&abandoned_hd, th, threads);
+#endif
+    wait_off_cpu(th);
+    thread_put(th);
+
+    preempt_enable();
+    return 0;
+}
+
+/**
+ * blocks the running thread until deadline (see clock_ns()) passes.
+ */
+static void sleep_until(uint64_t deadline) {
+    thread_waitq_t q = { NULL, &q.tqh_first, 0 };
+
+    preempt_disable();
+    // only the timer wheel wakes it up
+    waitq_lock(&q);
+    waitq_sleep(&q, deadline);
+    preempt_enable();
+}
+
+int thread_sleep_ns(uint64_t ns) {
+    // a deadline is never 0
+    sleep_until(clock_ns() + ns + 1);
+    return 0;
+}
+
+int thread_sleep_until(uint64_t deadline_ns) {
+    if (deadline_ns > clock_ns())
+        sleep_until(deadline_ns);
+    return 0;
+}
+
+/*      Implémentation des mutexes      */
+
+
+int thread_mutex_init(thread_mutex_t *mutex) {
+    if (mutex != NULL) {
+        mutex->is_destroyed = 0;
+        mutex->locker = NULL;
+        TAILQ_INIT(&mutex->waiters);
+        mutex->waiters.lock = 0;
+        return EXIT_SUCCESS;
+    }
+
+    return EXIT_FAILURE;
+}
+
+int thread_mutex_destroy(thread_mutex_t *mutex) {
+    if (mutex != NULL) {
+        mutex->is_destroyed = 1;
+        mutex->locker = NULL;
+        return EXIT_SUCCESS;
+    }
+
+    return EXIT_FAILURE;
+}
+
+/**
+ * locks the mutex, waiting for it until deadline (see clock_ns(), 0 for none).
+ * returns ETIMEDOUT if it is still locked then, EDEADLK if detect is set and
+ * its locker waits for the running thread, see deadlock_check().
+ */
+static int mutex_lock(thread_mutex_t *mutex, uint64_t deadline, int detect) {
+    struct thread *curr_th = worker_self()->current;
+    int ret = EXIT_SUCCESS;
+
+    //  we don't block if mutex not initialized/destroyed or owned by calling thread
+    if (mutex == NULL || mutex->is_destroyed != 0 || mutex->locker == (thread_t)curr_th) {
+        return EXIT_FAILURE;
+    }
+
+    // lock it atomically if it is available, the locker may run on another worker in M:N mode
+    if (__sync_bool_compare_and_swap(&mutex->locker, NULL, (thread_t)curr_th))
+        return EXIT_SUCCESS;
+
+    preempt_disable();
+
+    // only the waits without deadline can deadlock
+    if (deadline == 0) {
+        __atomic_store_n(&curr_th->wait_mutex, mutex, DEADLOCK_ORDER);
+        if (detect && deadlock_check(__atomic_load_n((struct thread **)&mutex->locker, DEADLOCK_ORDER))) {
+            curr_th->wait_mutex = NULL;
+            preempt_enable();
+            return EDEADLK;
+        }
+    }
+
+    waitq_lock(&mutex->waiters);
+
+    // otherwise we wait in the queue, unless it was released in the meantime:
+    // it stays locked while threads wait, so that they cannot be overtaken
+    if (__sync_bool_compare_and_swap(&mutex->locker, NULL, (thread_t)curr_th))
+        waitq_unlock(&mutex->waiters);
+    else {
+        trace(TRACE_MUTEX_WAIT, curr_th, mutex);
+        stats_mutex_contended(curr_th);
+        ret = waitq_sleep(&mutex->waiters, deadline); // thread_mutex_unlock() hands it over to us
+    }
+    curr_th->wait_mutex = NULL;
+
+    preempt_enable();
+    return ret;
+}
+
+int thread_mutex_lock(thread_mutex_t *mutex) {
+    return mutex_lock(mutex, 0, 1);
+}
+
+int thread_mutex_timedlock(thread_mutex_t *mutex, const struct timespec *abstime) {
+    if (abstime == NULL)
+        return EXIT_FAILURE;
+
+    return mutex_lock(mutex, deadline_from_abstime(abstime), 1);
+}
+
+int thread_mutex_unlock(thread_mutex_t *mutex) {
+    struct thread *curr_th = worker_self()->current;
+
+    // unlocking a mutex not owned by calling thread is an error
+    if (mutex == NULL || mutex->is_destroyed != 0 || mutex->locker != (thread_t)curr_th) {
+        return EXIT_FAILURE;
+    }
+
+    preempt_disable();
+    waitq_lock(&mutex->waiters);
+
+    // hand the mutex over to the first waiting thread, or release it,
+    // publishing the writes of the critical section
+    struct thread *next_th = waitq_pop(&mutex->waiters);
+    __atomic_store_n(&mutex->locker, (thread_t)next_th, __ATOMIC_RELEASE);
+
+    waitq_unlock(&mutex->waiters);
+
+    if (next_th != NULL) {
+        trace(TRACE_MUTEX_HANDOFF, next_th, mutex);
+        thread_wake(next_th);
+    }
+
+    preempt_enable();
+    return EXIT_SUCCESS;
+}
+
+/*      Implémentation des variables de condition      */
+
+
+int thread_cond_init(thread_cond_t *cond) {
+    if (cond == NULL)
+        return EXIT_FAILURE;
+
+    TAILQ_INIT(&cond->waiters);
+    cond->waiters.lock = 0;
+    return EXIT_SUCCESS;
+}
+
+int thread_cond_destroy(thread_cond_t *cond) {
+    // threads still wait on it
+    if (cond == NULL || !TAILQ_EMPTY(&cond->waiters))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * releases the mutex and blocks on the condition until deadline (0 for none),
+ * then locks the mutex again. returns 0 if signaled, ETIMEDOUT on timeout.
+ */
+static int cond_wait(thread_cond_t *cond, thread_mutex_t *mutex, uint64_t deadline) {
+    int ret;
+
+    preempt_disable();
+
+    // the mutex is released with the condition locked, so that a signal
+    // sent as soon as it is released finds us in the queue
+    waitq_lock(&cond->waiters);
+    thread_mutex_unlock(mutex);
+    ret = waitq_sleep(&cond->waiters, deadline);
+
+    // it must return with the mutex locked: the others detect the deadlocks through it
+    mutex_lock(mutex, 0, 0);
+
+    preempt_enable();
+    return ret;
+}
+
+int thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex) {
+    struct thread *curr_th = worker_self()->current;
+
+    // the mutex must be held by the calling thread
+    if (cond == NULL || mutex == NULL || mutex->locker != (thread_t)curr_th)
+        return EXIT_FAILURE;
+
+    return cond_wait(cond, mutex, 0);
+}
+
+int thread_cond_timedwait(thread_cond_t *cond, thread_mutex_t *mutex, const struct timespec *abstime) {
+    struct thread *curr_th = worker_self()->current;
+
+    if (cond == NULL || mutex == NULL || abstime == NULL || mutex->locker != (thread_t)curr_th)
+        return EXIT_FAILURE;
+
+    return cond_wait(cond, mutex, deadline_from_abstime(abstime));
+}
+
+int thread_cond_signal(thread_cond_t *cond) {
+    struct thread *th;
+
+    if (cond == NULL)
+        return EXIT_FAILURE;
+
+    // nobody to wake up, the waiters enqueue with the mutex held
+    if (__atomic_load_n(&cond->waiters.tqh_first, __ATOMIC_RELAXED) == NULL)
+        return EXIT_SUCCESS;
+
+    preempt_disable();
+
+    waitq_lock(&cond->waiters);
+    th = waitq_pop(&cond->waiters);
+    waitq_unlock(&cond->waiters);
+
+    if (th != NULL)
+        thread_wake(th);
+
+    preempt_enable();
+    return EXIT_SUCCESS;
+}
+
+int thread_cond_broadcast(thread_cond_t *cond) {
+    if (cond == NULL)
+        return EXIT_FAILURE;
+
+    if (__atomic_load_n(&cond->waiters.tqh_first, __ATOMIC_RELAXED) == NULL)
+        return EXIT_SUCCESS;
+
+    preempt_disable();
+
+    waitq_lock(&cond->waiters);
+    waitq_wake_all(&cond->waiters);
+
+    preempt_enable();
+    return EXIT_SUCCESS;
+}
+
+/*      Implémentation des sémaphores      */
+
+
+int thread_sem_init(thread_sem_t *sem, unsigned int value) {
+    if (sem == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sem->value = value;
+    TAILQ_INIT(&sem->waiters);
+    sem->waiters.lock = 0;
+    return 0;
+}
+
+int thread_sem_destroy(thread_sem_t *sem) {
+    // threads still wait on it
+    if (sem == NULL || !TAILQ_EMPTY(&sem->waiters)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * takes a token if there is one, without blocking. returns 1 on success.
+ */
+static inline int sem_take(thread_sem_t *sem) {
+    unsigned int value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+
+    while (value > 0) {
+        if (__atomic_compare_exchange_n(&sem->value, &value, value - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+
+    return 0;
+}
+
+int thread_sem_wait(thread_sem_t *sem) {
+    if (sem == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (sem_take(sem))
+        return 0;
+
+    preempt_disable();
+    waitq_lock(&sem->waiters);
+
+    // a token posted in the meantime is ours, otherwise thread_sem_post()
+    // hands the next one over to us
+    if (sem_take(sem))
+        waitq_unlock(&sem->waiters);
+    else
+        waitq_sleep(&sem->waiters, 0);
+
+    preempt_enable();
+    return 0;
+}
+
+int thread_sem_trywait(thread_sem_t *sem) {
+    if (sem == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!sem_take(sem)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+int thread_sem_post(thread_sem_t *sem) {
+    struct thread *th;
+
+    if (sem == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    preempt_disable();
+
+    // the queue is checked under its lock: a waiter may be about to sleep
+    waitq_lock(&sem->waiters);
+    th = waitq_pop(&sem->waiters);
+    if (th == NULL)
+        __atomic_add_fetch(&sem->value, 1, __ATOMIC_RELEASE);
+    waitq_unlock(&sem->waiters);
+
+    // the token goes straight to the first waiter, it cannot be overtaken
+    if (th != NULL)
+        thread_wake(th);
+
+    preempt_enable();
+    return 0;
+}
+
+/*      Implémentation des barrières      */
+
+
+int thread_barrier_init(thread_barrier_t *barrier, unsigned int count) {
+    if (barrier == NULL || count == 0)
+        return EXIT_FAILURE;
+
+    barrier->count = count;
+    barrier->arrived = 0;
+    TAILQ_INIT(&barrier->waiters);
+    barrier->waiters.lock = 0;
+    return EXIT_SUCCESS;
+}
+
+int thread_barrier_destroy(thread_barrier_t *barrier) {
+    // a phase is still in progress
+    if (barrier == NULL || barrier->arrived != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int thread_barrier_wait(thread_barrier_t *barrier) {
+    if (barrier == NULL)
+        return EXIT_FAILURE;
+
+    preempt_disable();
+    waitq_lock(&barrier->waiters);
+
+    // the last thread to arrive starts the next phase and releases the others
+    if (++barrier->arrived == barrier->count) {
+        barrier->arrived = 0;
+        waitq_wake_all(&barrier->waiters);
+        preempt_enable();
+        return THREAD_BARRIER_SERIAL_THREAD;
+    }
+
+    waitq_sleep(&barrier->waiters, 0);
+
+    preempt_enable();
+    return 0;
+}
+
+/*      Implémentation des verrous lecteurs/rédacteur      */
+
+// bits of thread_rwlock_t.state, the low bits count the readers holding it
+#define RWLOCK_WRITER  0x80000000u // held by a writer
+#define RWLOCK_WAITING 0x40000000u // threads are parked, unlocks go through the queues
+#define RWLOCK_READERS 0x3fffffffu
+
+int thread_rwlock_init(thread_rwlock_t *rwlock) {
+    if (rwlock == NULL)
+        return EXIT_FAILURE;
+
+    rwlock->state = 0;
+    TAILQ_INIT(&rwlock->readers);
+    rwlock->readers.lock = 0;
+    TAILQ_INIT(&rwlock->writers);
+    rwlock->writers.lock = 0;
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_destroy(thread_rwlock_t *rwlock) {
+    // still held or waited for
+    if (rwlock == NULL || rwlock->state != 0)
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * takes a read lock if no writer holds it or waits for it, returns 1 on success.
+ */
+static inline int rwlock_rdtake(thread_rwlock_t *rwlock) {
+    unsigned int state = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+
+    while (!(state & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+        if (__atomic_compare_exchange_n(&rwlock->state, &state, state + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * takes the write lock if nobody holds it, returns 1 on success.
+ */
+static inline int rwlock_wrtake(thread_rwlock_t *rwlock) {
+    unsigned int state = 0;
+
+    return __atomic_compare_exchange_n(&rwlock->state, &state, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/**
+ * parks the running thread in queue q of the rwlock, whose readers queue is locked,
+ * unless take() succeeds first. the lock is handed over to it by rwlock_handoff().
+ */
+static void rwlock_park(thread_rwlock_t *rwlock, thread_waitq_t *q, int (*take)(thread_rwlock_t *)) {
+    unsigned int state;
+
+    // once the waiting bit is set, the state only changes with the queues locked
+    do {
+        if (take(rwlock)) {
+            waitq_unlock(&rwlock->readers);
+            return;
+        }
+        state = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    } while (!(state & RWLOCK_WAITING)
+             && !__atomic_compare_exchange_n(&rwlock->state, &state, state | RWLOCK_WAITING, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    waitq_sleep_on(q, &rwlock->readers);
+}
+
+/**
+ * gives the released rwlock, whose queues are locked, to the first waiting
+ * writer, or else to all the waiting readers, then unlocks the queues.
+ */
+static void rwlock_handoff(thread_rwlock_t *rwlock) {
+    struct thread *th;
+    unsigned int readers = 0;
+
+    // writers go first, so that a stream of readers cannot starve them
+    th = waitq_pop(&rwlock->writers);
+    if (th != NULL) {
+        __atomic_store_n(&rwlock->state, RWLOCK_WRITER
+                         | (TAILQ_EMPTY(&rwlock->writers) && TAILQ_EMPTY(&rwlock->readers) ? 0 : RWLOCK_WAITING),
+                         __ATOMIC_RELEASE);
+        waitq_unlock(&rwlock->readers);
+        thread_wake(th);
+        return;
+    }
+
+    TAILQ_FOREACH(th, &rwlock->readers, threads)
+        readers++;
+    __atomic_store_n(&rwlock->state, readers, __ATOMIC_RELEASE);
+    waitq_wake_all(&rwlock->readers);
+}
+
+int thread_rwlock_rdlock(thread_rwlock_t *rwlock) {
+    if (rwlock == NULL)
+        return EXIT_FAILURE;
+
+    if (rwlock_rdtake(rwlock))
+        return EXIT_SUCCESS;
+
+    preempt_disable();
+    waitq_lock(&rwlock->readers);
+    rwlock_park(rwlock, &rwlock->readers, rwlock_rdtake);
+    preempt_enable();
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_wrlock(thread_rwlock_t *rwlock) {
+    if (rwlock == NULL)
+        return EXIT_FAILURE;
+
+    if (rwlock_wrtake(rwlock))
+        return EXIT_SUCCESS;
+
+    preempt_disable();
+    waitq_lock(&rwlock->readers);
+    rwlock_park(rwlock, &rwlock->writers, rwlock_wrtake);
+    preempt_enable();
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_tryrdlock(thread_rwlock_t *rwlock) {
+    if (rwlock == NULL || !rwlock_rdtake(rwlock))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_trywrlock(thread_rwlock_t *rwlock) {
+    if (rwlock == NULL || !rwlock_wrtake(rwlock))
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_unlock(thread_rwlock_t *rwlock) {
+    unsigned int state;
+
+    if (rwlock == NULL)
+        return EXIT_FAILURE;
+
+    // without waiters, a reader leaves or the writer releases it atomically
+    state = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    while (!(state & RWLOCK_WAITING)) {
+        if (state == 0)
+            return EXIT_FAILURE; // not locked
+        if (__atomic_compare_exchange_n(&rwlock->state, &state, state & RWLOCK_WRITER ? 0 : state - 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return EXIT_SUCCESS;
+    }
+
+    preempt_disable();
+    waitq_lock(&rwlock->readers);
+
+    // the last one out hands it over to the waiters
+    state = __atomic_load_n(&rwlock->state, __ATOMIC_RELAXED);
+    if (!(state & RWLOCK_WRITER) && (state & RWLOCK_READERS) > 1) {
+        __atomic_store_n(&rwlock->state, state - 1, __ATOMIC_RELEASE);
+        waitq_unlock(&rwlock->readers);
+    } else {
+        rwlock_handoff(rwlock);
+    }
+
+    preempt_enable();
+    return EXIT_SUCCESS;
+}
+
+/*      Implémentation des futures      */
+
+
+/* a thread blocked in thread_future_wait_any(), on its stack, and its nodes in
+ * the futures it waits for.
+ */
+struct future_wait {
+    thread_waitq_t q; // the blocked thread, its lock protects the other fields
+    int fired;        // index of the first future found ready, -1 until then
+    int done;         // number of futures that took the node out and are done with it
+};
+
+struct future_node {
+    struct future_wait *wait;
+    int index; // index of the future in the array given to thread_future_wait_any()
+    TAILQ_ENTRY(future_node) nodes;
+};
+
+struct thread_future {
+    int lock;    // protects the fields below, see spin_lock()
+    int ready;
+    void *value;
+    void *(*func)(void *); // computes the value, see thread_async() and thread_future_then()
+    void *funcarg;         // argument of func in thread_async()
+    TAILQ_HEAD(future_nodes, future_node) waiters; // threads blocked until it is ready
+    struct thread_future *conts;       // first continuation, see thread_future_then()
+    struct thread_future **conts_tail; // link to the last one
+    struct thread_future *next_cont;   // next continuation of the same future
+};
+
+// waits with more futures than this allocate their nodes
+#define FUTURE_NODES_INLINE 8
+
+int thread_future_create(thread_future_t *future) {
+    struct thread_future *f;
+
+    if (future == NULL)
+        return -1;
+
+    f = malloc(sizeof(*f));
+    if (f == NULL)
+        return -1;
+    f->lock = 0;
+    f->ready = 0;
+    f->value = NULL;
+    f->func = NULL;
+    f->funcarg = NULL;
+    TAILQ_INIT(&f->waiters);
+    f->conts = NULL;
+    f->conts_tail = &f->conts;
+    f->next_cont = NULL;
+
+    *future = f;
+    return 0;
+}
+
+int thread_future_set(thread_future_t future, void *value) {
+    struct future_nodes waiters = TAILQ_HEAD_INITIALIZER(waiters);
+    struct future_node *node, *next_node;
+    struct future_wait *wait;
+    struct thread_future *cont, *next_cont;
+    struct thread *th;
+    int index;
+
+    if (future == NULL)
+        return -1;
+
+    preempt_disable();
+    spin_lock(&future->lock);
+    if (future->ready) {
+        spin_unlock(&future->lock);
+        preempt_enable();
+        return -1;
+    }
+    future->value = value;
+    __atomic_store_n(&future->ready, 1, __ATOMIC_RELEASE);
+    // the future is not touched anymore once unlocked: it may be destroyed
+    TAILQ_CONCAT(&waiters, &future->waiters, nodes);
+    cont = future->conts;
+    spin_unlock(&future->lock);
+
+    // the nodes are on the stacks of the waiting threads, and the last access
+    // to a node is the unlock of its wait, see thread_future_wait_any()
+    for (node = TAILQ_FIRST(&waiters); node != NULL; node = next_node) {
+        next_node = TAILQ_NEXT(node, nodes);
+        wait = node->wait;
+        index = node->index;
+
+        th = NULL;
+        waitq_lock(&wait->q);
+        if (wait->fired < 0) {
+            wait->fired = index;
+            th = waitq_pop(&wait->q);
+        }
+        wait->done++;
+        waitq_unlock(&wait->q);
+        if (th != NULL)
+            thread_wake(th);
+    }
+    preempt_enable();
+
+    // the continuations run right here, with preemption
+    for (; cont != NULL; cont = next_cont) {
+        next_cont = cont->next_cont;
+        thread_future_set(cont, cont->func(value));
+    }
+
+    return 0;
+}
+
+/**
+ * entry point of the threads of thread_async().
+ */
+static void *future_runner(void *arg) {
+    struct thread_future *f = arg;
+
+    thread_future_set(f, f->func(f->funcarg));
+    return NULL;
+}
+
+int thread_async(thread_future_t *future, void *(*func)(void *), void *funcarg) {
+    thread_attr_t attr;
+    thread_t th;
+
+    if (func == NULL || thread_future_create(future) != 0)
+        return -1;
+    (*future)->func = func;
+    (*future)->funcarg = funcarg;
+
+    // the thread is released as soon as it exits, only the future is kept
+    thread_attr_init(&attr);
+    thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+    if (thread_create_attr(&th, &attr, future_runner, *future) != 0) {
+        free(*future);
+        return -1;
+    }
+
+    return 0;
+}
+
+int thread_future_wait_any(thread_future_t *futures, int n) {
+    struct future_node inline_nodes[FUTURE_NODES_INLINE], *nodes = inline_nodes;
+    struct future_wait wait = { { NULL, &wait.q.tqh_first, 0 }, -1, 0 };
+    struct thread_future *f;
+    int i, registered, expected = 0, done;
+
+    if (futures == NULL || n <= 0)
+        return -1;
+
+    // a future found ready spares the allocation
+    for (i = 0; i < n; i++) {
+        if (__atomic_load_n(&futures[i]->ready, __ATOMIC_ACQUIRE))
+            return i;
+    }
+    if (n > FUTURE_NODES_INLINE) {
+        nodes = malloc(n * sizeof(*nodes));
+        if (nodes == NULL)
+            return -1;
+    }
+
+    preempt_disable();
+
+    // the wait stays locked until we sleep in it, so that the first future
+    // to be ready cannot wake us up before
+    waitq_lock(&wait.q);
+    for (registered = 0; registered < n; registered++) {
+        f = futures[registered];
+        spin_lock(&f->lock);
+        if (f->ready) {
+            wait.fired = registered;
+            spin_unlock(&f->lock);
+            break;
+        }
+        nodes[registered].wait = &wait;
+        nodes[registered].index = registered;
+        TAILQ_INSERT_TAIL(&f->waiters, &nodes[registered], nodes);
+        spin_unlock(&f->lock);
+    }
+    if (wait.fired < 0)
+        waitq_sleep(&wait.q, 0);
+    else
+        waitq_unlock(&wait.q);
+
+    // take the nodes back, unless the future took them out when it got ready
+    for (i = 0; i < registered; i++) {
+        f = futures[i];
+        spin_lock(&f->lock);
+        if (f->ready)
+            expected++;
+        else
+            TAILQ_REMOVE(&f->waiters, &nodes[i], nodes);
+        spin_unlock(&f->lock);
+    }
+    // the threads setting them may still be using our stack, on other workers
+    for (;;) {
+        waitq_lock(&wait.q);
+        done = wait.done;
+        waitq_unlock(&wait.q);
+        if (done == expected)
+            break;
+        cpu_relax();
+    }
+
+    preempt_enable();
+
+    if (nodes != inline_nodes)
+        free(nodes);
+    return wait.fired;
+}
+
+int thread_future_wait_all(thread_future_t *futures, int n) {
+    int i;
+
+    if (futures == NULL || n < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (thread_future_wait_any(&futures[i], 1) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int thread_future_get(thread_future_t future, void **value) {
+    if (future == NULL || thread_future_wait_any(&future, 1) != 0)
+        return -1;
+
+    if (value)
+        *value = future->value;
+    return 0;
+}
+
+int thread_future_then(thread_future_t *next, thread_future_t future, void *(*func)(void *)) {
+    if (future == NULL || func == NULL || thread_future_create(next) != 0)
+        return -1;
+    (*next)->func = func;
+
+    preempt_disable();
+    spin_lock(&future->lock);
+    if (!future->ready) {
+        // run by thread_future_set()
+        *future->conts_tail = *next;
+        future->conts_tail = &(*next)->next_cont;
+        spin_unlock(&future->lock);
+        preempt_enable();
+        return 0;
+    }
+    spin_unlock(&future->lock);
+    preempt_enable();
+
+    return thread_future_set(*next, func(future->value));
+}
+
+int thread_future_destroy(thread_future_t future) {
+    int ready;
+
+    if (future == NULL)
+        return -1;
+
+    // once it is ready, thread_future_set() is done with it
+    preempt_disable();
+    spin_lock(&future->lock);
+    ready = future->ready;
+    spin_unlock(&future->lock);
+    preempt_enable();
+    if (!ready)
+        return -1;
+
+    free(future);
+    return 0;
+}
+
+/*      Entrées/sorties      */
+
+
+#ifdef THREAD_IO_URING
+/**
+ * sets up the io_uring ring, whose completions are signaled to the epoll
+ * instance epfd. the threads fall back to epoll if it fails.
+ */
+static void io_ring_setup(int epfd) {
+    const char *env = getenv("THREAD_IO_URING");
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    if (env != NULL && atoi(env) == 0)
+        return;
+    if (uring_init(&io_ring, IO_RING_ENTRIES, IO_RING_CQ_ENTRIES) != 0)
+        return;
+
+    io_ring_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.data.fd = io_ring_eventfd;
+    if (io_ring_eventfd < 0
+        || syscall(__NR_io_uring_register, io_ring.fd, IORING_REGISTER_EVENTFD, &io_ring_eventfd, 1) != 0
+        || epoll_ctl(epfd, EPOLL_CTL_ADD, io_ring_eventfd, &ev) != 0) {
+        if (io_ring_eventfd >= 0)
+            close(io_ring_eventfd);
+        io_ring_eventfd = -1;
+        uring_destroy(&io_ring);
+        return;
+    }
+    io_ring_ok = 1;
+}
+#endif
+
+/**
+ * creates the epoll instance, and in M:N mode the eventfd that interrupts
+ * the worker waiting in it.
+ */
+static void io_setup(void) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epfd < 0)
+        return;
+#ifdef THREAD_MN
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    io_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.data.fd = io_eventfd;
+    if (io_eventfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, io_eventfd, &ev) != 0) {
+        close(epfd);
+        return;
+    }
+#endif
+#ifdef THREAD_IO_URING
+    io_ring_setup(epfd);
+#endif
+    __atomic_store_n(&io_epfd, epfd, __ATOMIC_RELEASE);
+}
+
+/**
+ * returns 0 once the epoll instance exists, -1 if it cannot be created.
+ */
+static int io_init(void) {
+#ifdef THREAD_MN
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, io_setup);
+#else
+    if (io_epfd < 0)
+        io_setup();
+#endif
+
+    return __atomic_load_n(&io_epfd, __ATOMIC_ACQUIRE) >= 0 ? 0 : -1;
+}
+
+/**
+ * blocks the running thread until descriptor fd gets one of the epoll events,
+ * or until deadline (see clock_ns(), 0 for none) passes.
+ * returns 0 once it may be ready, ETIMEDOUT on timeout, -1 if it cannot be
+ * waited on with errno set.
+ */
+static int io_wait(int fd, uint32_t events, uint64_t deadline) {
+    struct thread *curr_th = worker_self()->current;
+    struct io_fd *f;
+    struct thread *th;
+    uint32_t waited = events;
+    int ret;
+
+    if (io_init() != 0)
+        return -1;
+    f = io_fd_get(fd);
+    if (f == NULL) {
+        errno = fd < 0 ? EBADF : ENOMEM;
+        return -1;
+    }
+
+    preempt_disable();
+    waitq_lock(&f->waiters);
+
+    // armed for the events of all the threads that wait, level-triggered:
+    // if it got ready since the operation failed, it is reported right away
+    TAILQ_FOREACH(th, &f->waiters, threads)
+        waited |= th->io_events;
+    if (io_arm(fd, f, waited) != 0) {
+        waitq_unlock(&f->waiters);
+        preempt_enable();
+        return -1;
+    }
+
+    curr_th->io_events = events;
+    __atomic_add_fetch(&nr_io_waiting, 1, __ATOMIC_SEQ_CST);
+    ret = waitq_sleep(&f->waiters, deadline);
+    __atomic_sub_fetch(&nr_io_waiting, 1, __ATOMIC_SEQ_CST);
+
+    preempt_enable();
+    return ret;
+}
+
+#ifdef THREAD_IO_URING
+/**
+ * returns 1 if the I/O go through io_uring.
+ */
+static inline int io_ring_ready(void) {
+    return io_init() == 0 && io_ring_ok;
+}
+
+/**
+ * performs an operation with io_uring on behalf of the running thread, which
+ * sleeps until it completes. the request is passed to the kernel with the
+ * others queued meanwhile when the worker switches to the next thread, see
+ * runq_pop() and io_ring_flush().
+ * off also holds the second address of the operations that have one.
+ * returns the result of the operation, -errno on failure.
+ */
+static int io_ring_run(uint8_t opcode, int fd, const void *addr, size_t len, uint64_t off) {
+    struct thread *curr_th = worker_self()->current;
+    struct io_req req = { curr_th, 0 };
+    struct io_uring_sqe *sqe;
+
+    preempt_disable();
+    spin_lock(&io_ring_sq_lock);
+    // the submission queue is full: pass it to the kernel right away
+    while ((sqe = uring_get_sqe(&io_ring)) == NULL) {
+        if (uring_submit(&io_ring, 0) < 0 && errno != EBUSY && errno != EAGAIN) {
+            spin_unlock(&io_ring_sq_lock);
+            preempt_enable();
+            return -errno;
+        }
+    }
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len > INT_MAX ? INT_MAX : len;
+    sqe->off = off;
+    sqe->user_data = (uintptr_t)&req;
+
+    curr_th->state = BLOCKED;
+    __atomic_add_fetch(&nr_io_waiting, 1, __ATOMIC_SEQ_CST);
+    spin_unlock(&io_ring_sq_lock);
+
+    // woken up by io_ring_reap()
+    sched_reschedule(0);
+
+    __atomic_sub_fetch(&nr_io_waiting, 1, __ATOMIC_SEQ_CST);
+    preempt_enable();
+
+    return req.res;
+}
+
+static inline ssize_t io_ring_result(int res) {
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+#endif
+
+/**
+ * puts descriptor fd in non-blocking mode, so that it never blocks the worker.
+ */
+static int io_nonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0)
+        return -1;
+    if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    return 0;
+}
+
+/**
+ * reads (or writes if out is set) a descriptor other than a socket without
+ * blocking the worker. it is only non-blocking during the call: its file
+ * description may be shared with other processes, such as an inherited stdin.
+ */
+static ssize_t io_rw_nonblock(int fd, void *buf, size_t count, int out) {
+    int flags = fcntl(fd, F_GETFL), saved_errno;
+    ssize_t n;
+
+    if (flags < 0)
+        return -1;
+    if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+    n = out ? write(fd, buf, count) : read(fd, buf, count);
+    if (!(flags & O_NONBLOCK)) {
+        saved_errno = errno;
+        fcntl(fd, F_SETFL, flags);
+        errno = saved_errno;
+    }
+
+    return n;
+}
+
+ssize_t thread_read(int fd, void *buf, size_t count) {
+    ssize_t n;
+
+#ifdef THREAD_IO_URING
+    if (io_ring_ready()) {
+        n = io_ring_run(IORING_OP_READ, fd, buf, count, (uint64_t)-1);
+        // a non-blocking descriptor, waited on with epoll
+        if (n != -EAGAIN)
+            return io_ring_result(n);
+    }
+#endif
+
+    for (;;) {
+        // sockets are read without changing their mode, other descriptors for the call only
+        n = recv(fd, buf, count, MSG_DONTWAIT);
+        if (n < 0 && errno == ENOTSOCK)
+            n = io_rw_nonblock(fd, buf, count, 0);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+        if (io_wait(fd, EPOLLIN | EPOLLRDHUP, 0) < 0)
+            return -1;
+    }
+}
+
+ssize_t thread_write(int fd, const void *buf, size_t count) {
+    ssize_t n;
+
+#ifdef THREAD_IO_URING
+    if (io_ring_ready()) {
+        n = io_ring_run(IORING_OP_WRITE, fd, buf, count, (uint64_t)-1);
+        if (n != -EAGAIN)
+            return io_ring_result(n);
+    }
+#endif
+
+    for (;;) {
+        n = send(fd, buf, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = io_rw_nonblock(fd, (void *)buf, count, 1);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return n;
+        if (io_wait(fd, EPOLLOUT, 0) < 0)
+            return -1;
+    }
+}
+
+int thread_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+    int fd;
+
+#ifdef THREAD_IO_URING
+    if (io_ring_ready()) {
+        fd = io_ring_run(IORING_OP_ACCEPT, sockfd, addr, 0, (uintptr_t)addrlen);
+        if (fd != -EAGAIN)
+            return io_ring_result(fd);
+    }
+#endif
+
+    if (io_nonblock(sockfd) != 0)
+        return -1;
+
+    for (;;) {
+        fd = accept(sockfd, addr, addrlen);
+        if (fd >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            return fd;
+        if (io_wait(sockfd, EPOLLIN, 0) < 0)
+            return -1;
+    }
+}
+
+int thread_connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
+    socklen_t len = sizeof(int);
+    int err, in_progress = 0;
+
+#ifdef THREAD_IO_URING
+    // the socket stays in blocking mode, the ring waits for it anyway
+    if (io_ring_ready()) {
+        err = io_ring_run(IORING_OP_CONNECT, sockfd, addr, 0, addrlen);
+        if (err != -EAGAIN && err != -EINPROGRESS)
+            return io_ring_result(err);
+        // the caller made the socket non-blocking: connecting again would fail with EALREADY
+        in_progress = err == -EINPROGRESS;
+    }
+#endif
+
+    if (!in_progress) {
+        if (io_nonblock(sockfd) != 0)
+            return -1;
+        if (connect(sockfd, addr, addrlen) == 0)
+            return 0;
+        if (errno != EINPROGRESS)
+            return -1;
+    }
+
+    // the connection completes in the background, its result is then in SO_ERROR
+    if (io_wait(sockfd, EPOLLOUT, 0) < 0)
+        return -1;
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        return -1;
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+ssize_t thread_pread(int fd, void *buf, size_t count, off_t offset) {
+#ifdef THREAD_IO_URING
+    if (io_ring_ready()) {
+        struct iovec iov = { buf, count };
+        // the data in the page cache is copied right away, the disk is left to the ring
+        ssize_t n = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+        if (n >= 0 || (errno != EAGAIN && errno != EOPNOTSUPP))
+            return n;
+        return io_ring_result(io_ring_run(IORING_OP_READ, fd, buf, count, offset));
+    }
+#endif
+    // files are always ready for epoll, the worker blocks
+    return pread(fd, buf, count, offset);
+}
+
+ssize_t thread_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+#ifdef THREAD_IO_URING
+    if (io_ring_ready())
+        return io_ring_result(io_ring_run(IORING_OP_WRITE, fd, buf, count, offset));
+#endif
+    return pwrite(fd, buf, count, offset);
+}
+
+int thread_fsync(int fd) {
+#ifdef THREAD_IO_URING
+    if (io_ring_ready())
+        return io_ring_result(io_ring_run(IORING_OP_FSYNC, fd, NULL, 0, 0));
+#endif
+    return fsync(fd);
+}
+
+int thread_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    uint64_t deadline = timeout > 0 ? clock_ns() + (uint64_t)timeout * 1000000ULL : 0;
+    struct epoll_event ev;
+    nfds_t i, j;
+    int n, epfd = -1, ret;
+
+    for (;;) {
+        n = poll(fds, nfds, 0);
+        if (n != 0 || timeout == 0)
+            break;
+
+        if (nfds == 1 && fds[0].fd >= 0) {
+            // the poll and epoll events have the same values
+            ret = io_wait(fds[0].fd, fds[0].events, deadline);
+        } else {
+            // several descriptors are gathered once in an epoll instance the thread waits on,
+            // the negative ones are ignored as by poll(): an empty instance waits until the deadline
+            if (epfd < 0) {
+                epfd = epoll_create1(EPOLL_CLOEXEC);
+                if (epfd < 0)
+                    return -1;
+                for (i = 0; i < nfds; i++) {
+                    if (fds[i].fd < 0)
+                        continue;
+                    // a descriptor given several times is registered once with all its events
+                    for (j = 0; j < i && fds[j].fd != fds[i].fd; j++)
+                        ;
+                    if (j < i)
+                        continue;
+                    ev.events = fds[i].events;
+                    ev.data.fd = fds[i].fd;
+                    for (j = i + 1; j < nfds; j++)
+                        if (fds[j].fd == fds[i].fd)
+                            ev.events |= fds[j].events;
+                    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) != 0) {
+                        n = -1;
+                        break;
+                    }
+                }
+                if (n < 0)
+                    break;
+            }
+            ret = io_wait(epfd, EPOLLIN, deadline);
+        }
+
+        if (ret < 0) {
+            n = -1;
+            break;
+        }
+        if (ret == ETIMEDOUT) {
+            n = poll(fds, nfds, 0);
+            break;
+        }
+    }
+
+    if (epfd >= 0) {
+        ret = errno;
+        close(epfd);
+        errno = ret;
+    }
+
+    return n;
+}
@@ -0,0 +1,175 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Minimal io_uring ring, set up with the raw system calls.
+ *
+ * The caller fills submission entries taken with uring_get_sqe(), submits them
+ * all at once with uring_submit(), and consumes the completions with
+ * uring_peek_cqe()/uring_cqe_seen(). Nothing here is thread-safe: the
+ * submission side and the completion side each need their own lock when the
+ * ring is shared between kernel threads.
+ *
+ * Memory orderings follow the io_uring(7) manual page: the tails written by
+ * the producer are released, and the consumer acquires them.
+ */
+
+struct uring {
+    int fd;
+    // submission queue, shared with the kernel
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_entries;
+    unsigned int sq_pending; // entries filled but not yet passed to the kernel
+    // completion queue, shared with the kernel
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    // mappings, unmapped by uring_destroy()
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+/**
+ * sets up a ring of sq_entries submission and cq_entries completion entries.
+ * returns 0 on success, -1 on failure with errno set (io_uring may be
+ * unsupported or disabled).
+ */
+static inline int uring_init(struct uring *r, unsigned int sq_entries, unsigned int cq_entries) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    r->fd = syscall(__NR_io_uring_setup, sq_entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    // both rings share one mapping on the kernels that can
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto err_fd;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+            goto err_sq;
+    }
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto err_cq;
+
+    r->sq_head = (unsigned int *)((char *)r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned int *)((char *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned int *)((char *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)((char *)r->sq_ring + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned int *)((char *)r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned int *)((char *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned int *)((char *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ring + p.cq_off.cqes);
+
+    return 0;
+
+err_cq:
+    if (r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+err_sq:
+    munmap(r->sq_ring, r->sq_ring_size);
+err_fd:
+    close(r->fd);
+    r->fd = -1;
+    return -1;
+}
+
+/**
+ * unmaps and closes the ring.
+ */
+static inline void uring_destroy(struct uring *r) {
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+    r->fd = -1;
+}
+
+/**
+ * returns a cleared submission entry, queued at the next uring_submit(),
+ * or NULL if the submission queue is full.
+ */
+static inline struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+    unsigned int head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned int tail = *r->sq_tail + r->sq_pending;
+    struct io_uring_sqe *sqe;
+
+    if (tail - head >= r->sq_entries)
+        return NULL;
+
+    sqe = &r->sqes[tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[tail & *r->sq_mask] = tail & *r->sq_mask;
+    r->sq_pending++;
+
+    return sqe;
+}
+
+/**
+ * passes the pending submission entries to the kernel, and waits for
+ * min_complete completions. returns the number of entries submitted,
+ * -1 on failure with errno set.
+ * the entries left over by a failed or partial submission go with the next one.
+ */
+static inline int uring_submit(struct uring *r, unsigned int min_complete) {
+    unsigned int tail = *r->sq_tail + r->sq_pending;
+    unsigned int n;
+    int ret;
+
+    __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+    r->sq_pending = 0;
+    n = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    do {
+        ret = syscall(__NR_io_uring_enter, r->fd, n, min_complete,
+                      min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+/**
+ * returns the oldest completion not consumed yet, NULL if there is none.
+ */
+static inline struct io_uring_cqe *uring_peek_cqe(struct uring *r) {
+    unsigned int head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &r->cqes[head & *r->cq_mask];
+}
+
+/**
+ * gives the oldest completion back to the kernel.
+ */
+static inline void uring_cqe_seen(struct uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* __URING_H__ */
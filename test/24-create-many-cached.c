@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "thread.h"
+
+/* test de plein de create/join par vagues successives avec le cache de threads
+ *
+ * le cache est limité à une vague et pré-rempli: à partir de la première vague,
+ * les threads créés réutilisent la structure et la pile des threads joints.
+ * valgrind doit etre content.
+ * la durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_cache_config()
+ * - thread_create()
+ * - retour sans thread_exit()
+ * - thread_join() avec récupération de la valeur de retour
+ */
+
+#define WAVE 16
+
+static void * thfunc(void *arg)
+{
+  return arg;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t th[WAVE];
+  int err, i, j, nb;
+  struct timeval tv1, tv2;
+  unsigned long us;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+
+  nb = atoi(argv[1]);
+
+  err = thread_cache_config(WAVE, WAVE);
+  assert(!err);
+
+  gettimeofday(&tv1, NULL);
+
+  for(i=0; i<nb; i+=WAVE) {
+    int n = (nb - i < WAVE) ? nb - i : WAVE;
+
+    for(j=0; j<n; j++) {
+      err = thread_create(&th[j], thfunc, (void*) (unsigned long) (i+j));
+      assert(!err);
+    }
+
+    for(j=0; j<n; j++) {
+      void *res;
+      err = thread_join(th[j], &res);
+      assert(!err);
+      assert(res == (void*) (unsigned long) (i+j));
+    }
+  }
+
+  gettimeofday(&tv2, NULL);
+  us = (tv2.tv_sec-tv1.tv_sec)*1000000+(tv2.tv_usec-tv1.tv_usec);
+  printf("%d threads créés et détruits par vagues de %d en %ld us\n", nb, WAVE, us);
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "thread.h"
+
+/* test de plein de threads vivants mais inactifs en même temps
+ *
+ * chaque thread n'utilise que le début de sa pile: la mémoire résidente
+ * doit rester petite devant nombre de threads * taille de pile.
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_yield() depuis ou vers le main
+ * - retour sans thread_exit()
+ * - thread_join() sans récupération de la valeur de retour
+ */
+
+static void * thfunc(void *dummy __attribute__((unused)))
+{
+  thread_yield();
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th;
+  int err, i, nb;
+  struct rusage ru;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+
+  nb = atoi(argv[1]);
+
+  th = malloc(nb*sizeof(*th));
+  if (!th) {
+    perror("malloc");
+    return -1;
+  }
+
+  /* on cree tous les threads */
+  for(i=0; i<nb; i++) {
+    err = thread_create(&th[i], thfunc, NULL);
+    assert(!err);
+  }
+
+  /* ils démarrent tous et se mettent en attente dans thread_yield() */
+  thread_yield();
+
+  getrusage(RUSAGE_SELF, &ru);
+
+  for(i=0; i<nb; i++) {
+    err = thread_join(th[i], NULL);
+    assert(!err);
+  }
+
+  free(th);
+
+  printf("%d threads inactifs simultanés: %ld Kio de mémoire résidente\n", nb, ru.ru_maxrss);
+  return 0;
+}
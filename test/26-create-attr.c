@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread.h"
+
+/* test de création de threads avec des attributs
+ *
+ * - un thread avec une grosse pile fait une récursion profonde,
+ * - un thread avec une petite pile fait un calcul simple,
+ * - des threads détachés se terminent sans être joints.
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_attr_init(), thread_attr_destroy()
+ * - thread_attr_setstacksize(), thread_attr_setpriority(), thread_attr_setdetachstate()
+ * - thread_create_attr()
+ * - thread_yield() depuis ou vers le main
+ * - thread_join() avec récupération de la valeur de retour
+ */
+
+#define BIGSTACK (4*1024*1024)
+#define DEPTH 1000
+#define NBDETACHED 100
+
+static int detached_done = 0;
+
+/* chaque niveau utilise au moins 1 Kio de pile */
+static unsigned long deep(unsigned long n)
+{
+  volatile char buf[1024];
+  memset((char *) buf, (int) n, sizeof(buf));
+  if (n == 0)
+    return 0;
+  return buf[0] + deep(n-1) - buf[0] + 1;
+}
+
+static void * deepfunc(void *arg)
+{
+  return (void*) deep((unsigned long) arg);
+}
+
+static void * smallfunc(void *arg)
+{
+  return (void*) ((unsigned long) arg * 2);
+}
+
+static void * detachedfunc(void *dummy __attribute__((unused)))
+{
+  __sync_fetch_and_add(&detached_done, 1);
+  return NULL;
+}
+
+int main()
+{
+  thread_attr_t attr;
+  thread_t th1, th2, th;
+  void *res;
+  int err, i;
+
+  err = thread_attr_init(&attr);
+  assert(!err);
+  err = thread_attr_setstacksize(&attr, BIGSTACK);
+  assert(!err);
+  err = thread_create_attr(&th1, &attr, deepfunc, (void*) DEPTH);
+  assert(!err);
+
+  err = thread_attr_setstacksize(&attr, THREAD_STACK_MIN);
+  assert(!err);
+  err = thread_attr_setpriority(&attr, THREAD_PRIO_MAX);
+  assert(!err);
+  err = thread_create_attr(&th2, &attr, smallfunc, (void*) 21);
+  assert(!err);
+
+  err = thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+  assert(!err);
+  for(i=0; i<NBDETACHED; i++) {
+    err = thread_create_attr(&th, &attr, detachedfunc, NULL);
+    assert(!err);
+  }
+  thread_attr_destroy(&attr);
+
+  err = thread_join(th1, &res);
+  assert(!err);
+  assert(res == (void*) DEPTH);
+  err = thread_join(th2, &res);
+  assert(!err);
+  assert(res == (void*) 42);
+
+  /* on laisse les threads détachés se terminer */
+  while (detached_done < NBDETACHED)
+    thread_yield();
+
+  printf("attributs OK: pile de %d Kio, %d threads détachés\n", BIGSTACK/1024, detached_done);
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "thread.h"
+
+/* test de la libération des threads détachés, sans join.
+ *
+ * le main crée des threads courts par paquets: un tiers détachés dès la
+ * création par attribut, un tiers détachés avec thread_detach() avant qu'ils
+ * s'exécutent, et un tiers détachés une fois terminés. il attend la fin de
+ * chaque paquet avec thread_yield(). la mémoire résidente ne doit pas grandir
+ * après le premier dixième des threads, le temps de remplir le cache réduit à
+ * CACHE_MAX threads (un par thread noyau en M:N): les piles sont rendues au
+ * cache ou libérées.
+ * avant cela, joindre un thread détaché qui s'exécute encore doit échouer
+ * avec errno à EINVAL.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create_attr() avec THREAD_CREATE_DETACHED
+ * - thread_detach()
+ * - thread_yield()
+ * - thread_cache_config()
+ */
+
+#define BATCH 300
+#define CACHE_MAX 64
+#define MAX_GROWTH_KB 4096
+
+static int done = 0, released = 0;
+
+static void * shortfunc(void *dummy __attribute__((unused)))
+{
+  __sync_fetch_and_add(&done, 1);
+  return NULL;
+}
+
+/* attend que le main le libère, puis le signale */
+static void * blockedfunc(void *dummy __attribute__((unused)))
+{
+  while (__sync_fetch_and_add(&released, 0) == 0)
+    thread_yield();
+  __sync_fetch_and_add(&released, 1);
+  return NULL;
+}
+
+/* mémoire résidente en Kio */
+static long rss_kb(void)
+{
+  long size, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+
+  if (f) {
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+      resident = 0;
+    fclose(f);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void wait_done(int n)
+{
+  while (__sync_fetch_and_add(&done, 0) < n)
+    thread_yield();
+}
+
+int main(int argc, char *argv[])
+{
+  thread_attr_t attr;
+  thread_t th;
+  long rss0 = 0, rss1;
+  int err, i, nb, created = 0;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+
+  err = thread_cache_config(CACHE_MAX, 0);
+  assert(!err);
+  err = thread_attr_init(&attr);
+  assert(!err);
+  err = thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+  assert(!err);
+
+  err = thread_create_attr(&th, &attr, blockedfunc, NULL);
+  assert(!err);
+  errno = 0;
+  if (thread_join(th, NULL) != -1 || errno != EINVAL) {
+    printf("thread_join d'un thread détaché INCORRECT: errno %d\n", errno);
+    return EXIT_FAILURE;
+  }
+  __sync_fetch_and_add(&released, 1);
+  while (__sync_fetch_and_add(&released, 0) < 2)
+    thread_yield();
+
+  while (created < nb) {
+    for(i=0; i<BATCH && created < nb; i++, created++) {
+      switch (i % 3) {
+      case 0:
+        err = thread_create_attr(&th, &attr, shortfunc, NULL);
+        assert(!err);
+        break;
+      case 1:
+        err = thread_create(&th, shortfunc, NULL);
+        assert(!err);
+        err = thread_detach(th);
+        assert(!err);
+        break;
+      default:
+        err = thread_create(&th, shortfunc, NULL);
+        assert(!err);
+        wait_done(created + 1);
+        err = thread_detach(th);
+        assert(!err);
+      }
+    }
+    wait_done(created);
+    if (rss0 == 0 && created >= nb / 10)
+      rss0 = rss_kb();
+  }
+  rss1 = rss_kb();
+
+  thread_attr_destroy(&attr);
+
+  printf("%d threads détachés terminés, mémoire résidente %+ld Kio après le premier dixième\n",
+         nb, rss1 - rss0);
+  if (rss1 - rss0 > MAX_GROWTH_KB) {
+    printf("mémoire INCORRECTE: les threads détachés ne sont pas libérés\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
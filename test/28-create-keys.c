@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "thread.h"
+
+/* test des données propres aux threads.
+ *
+ * le main crée NKEYS clés, dont certaines sans destructeur, puis détruit la
+ * dernière. chaque thread range dans toutes les clés l'adresse d'une de ses
+ * variables locales, fait des yield, et vérifie qu'il retrouve ses propres
+ * valeurs. à sa terminaison, les destructeurs doivent être appelés une fois
+ * par clé qui en a un, sauf celui de la clé détruite, avec la bonne valeur.
+ * le destructeur de la première clé redonne une valeur une fois, et doit
+ * donc être appelé deux fois. les threads créés ensuite, avec les mêmes
+ * structures recyclées, doivent lire des valeurs NULL.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_yield()
+ * - thread_key_create()/thread_key_delete()
+ * - thread_getspecific()/thread_setspecific()
+ */
+
+/* assez de clés pour dépasser celles rangées dans la structure du thread */
+#define NKEYS 20
+#define BATCH 10
+
+static thread_key_t keys[NKEYS];
+static int destroyed = 0, errors = 0;
+
+static void destructor(void *value)
+{
+  /* chaque thread range l'adresse de son tableau de marques */
+  char *marks = value;
+  __sync_fetch_and_add(&destroyed, 1);
+  marks[0]++;
+}
+
+static void destructor_again(void *value)
+{
+  char *marks = value;
+  __sync_fetch_and_add(&destroyed, 1);
+  /* redonne une valeur la première fois */
+  if (marks[1]++ == 0)
+    thread_setspecific(keys[0], marks);
+}
+
+static void * thfunc(void *_marks)
+{
+  char *marks = _marks;
+  int i;
+
+  for(i=0; i<NKEYS; i++) {
+    if (thread_getspecific(keys[i]) != NULL)
+      __sync_fetch_and_add(&errors, 1);
+    if (i < NKEYS-1)
+      thread_setspecific(keys[i], marks);
+  }
+  thread_yield();
+  for(i=0; i<NKEYS-1; i++) {
+    if (thread_getspecific(keys[i]) != marks)
+      __sync_fetch_and_add(&errors, 1);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th;
+  char *marks;
+  int err, i, j, nb, expected;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(*th));
+  marks = calloc(nb, 2);
+  if (!th || !marks) {
+    perror("malloc");
+    return -1;
+  }
+
+  /* une clé sur trois n'a pas de destructeur */
+  err = thread_key_create(&keys[0], destructor_again);
+  assert(!err);
+  for(i=1; i<NKEYS; i++) {
+    err = thread_key_create(&keys[i], i % 3 ? destructor : NULL);
+    assert(!err);
+  }
+  err = thread_key_delete(keys[NKEYS-1]);
+  assert(!err);
+  err = thread_key_delete(keys[NKEYS-1]);
+  assert(err);
+  err = thread_setspecific(keys[NKEYS-1], marks);
+  assert(err);
+
+  /* par paquets, pour recycler les structures des threads */
+  for(j=0; j<nb; j+=BATCH) {
+    for(i=j; i<nb && i<j+BATCH; i++) {
+      err = thread_create(&th[i], thfunc, &marks[2*i]);
+      assert(!err);
+    }
+    for(i=j; i<nb && i<j+BATCH; i++) {
+      err = thread_join(th[i], NULL);
+      assert(!err);
+    }
+  }
+
+  /* destructeurs des clés 1 à NKEYS-2 qui en ont un, et deux fois celui de la clé 0 */
+  expected = 2;
+  for(i=1; i<NKEYS-1; i++)
+    if (i % 3)
+      expected++;
+  for(i=0; i<nb; i++)
+    if (marks[2*i] != expected-2 || marks[2*i+1] != 2)
+      errors++;
+
+  printf("%d threads, %d destructeurs appelés pour %d attendus, %d erreurs\n",
+         nb, destroyed, nb * expected, errors);
+  free(marks);
+  free(th);
+  if (errors || destroyed != nb * expected) {
+    printf("données propres INCORRECTES\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
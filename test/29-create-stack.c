@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "thread.h"
+
+/* test de la mesure de l'usage des piles.
+ *
+ * le main active la mesure puis crée nb threads qui utilisent au moins DEEP
+ * octets de pile et nb threads qui en utilisent peu, avec deux fonctions de
+ * démarrage différentes. après les avoir joints, il arrête la mesure et relit
+ * le rapport: chaque fonction doit avoir ses nb threads, l'usage maximal de
+ * la première doit dépasser DEEP sans dépasser la pile, celui de la seconde
+ * doit rester en dessous de DEEP, et la taille suggérée doit couvrir l'usage.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_stack_config()
+ */
+
+#define DEEP (16*1024)
+
+static void * deep(void *arg)
+{
+  volatile char buf[DEEP];
+  int i;
+
+  for (i = 0; i < DEEP; i++)
+    buf[i] = (char)i;
+  return (void *)(long)buf[DEEP / 2] + (long)arg;
+}
+
+static void * shallow(void *arg)
+{
+  return arg;
+}
+
+int main(int argc, char *argv[])
+{
+  char path[] = "/tmp/29-create-stack.XXXXXX", line[4096];
+  unsigned long long threads, max, mean, hint;
+  unsigned long long deep_threads = 0, deep_max = 0, deep_hint = 0;
+  unsigned long long shallow_threads = 0, shallow_max = 0, all_threads = 0;
+  thread_t th;
+  void *func;
+  FILE *f;
+  int i, nb, fd, err, errors = 0;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+
+  fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  if (thread_stack_config(path) != 0) {
+    printf("mesure des piles indisponible\n");
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < 2 * nb; i++) {
+    err = thread_create(&th, i % 2 ? shallow : deep, NULL);
+    assert(!err);
+    err = thread_join(th, NULL);
+    assert(!err);
+  }
+
+  err = thread_stack_config(NULL);
+  assert(!err);
+
+  f = fopen(path, "r");
+  assert(f);
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, "all threads=%llu", &all_threads) == 1)
+      continue;
+    if (sscanf(line, "func=%p", &func) != 1)
+      continue;
+    err = sscanf(strstr(line, " threads="), " threads=%llu max=%llu mean=%llu hint=%llu",
+                 &threads, &max, &mean, &hint);
+    assert(err == 4);
+    if (func == (void *)deep) {
+      deep_threads = threads;
+      deep_max = max;
+      deep_hint = hint;
+    } else if (func == (void *)shallow) {
+      shallow_threads = threads;
+      shallow_max = max;
+    }
+  }
+  fclose(f);
+  unlink(path);
+
+  if (all_threads != 2ULL * nb || deep_threads != (unsigned long long)nb
+      || shallow_threads != (unsigned long long)nb)
+    errors++;
+  if (deep_max < DEEP || deep_max >= 64 * 1024 || deep_hint < deep_max)
+    errors++;
+  if (shallow_max >= DEEP || shallow_max == 0)
+    errors++;
+
+  printf("%d threads par fonction: profonde max %llu octets (suggéré %llu), peu profonde max %llu octets, %d erreurs\n",
+         nb, deep_max, deep_hint, shallow_max, errors);
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include "thread.h"
+
+/* mesure de la latence d'un changement de contexte
+ *
+ * le main et un fils se passent la main nbyield fois chacun,
+ * on affiche le temps moyen d'un yield (donc d'un changement de contexte).
+ * permet de comparer les backends de changement de contexte
+ * (assembleur ou swapcontext) entre eux et avec les pthreads.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_yield() depuis ou vers le main
+ * - retour sans thread_exit()
+ * - thread_join() sans récupération de la valeur de retour
+ */
+
+static void * thfunc(void *_nbyield)
+{
+  int nbyield = (intptr_t) _nbyield;
+  int i;
+
+  for(i=0; i<nbyield; i++)
+    thread_yield();
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int i, err, nbyield;
+  thread_t th;
+  struct timespec ts1, ts2;
+  double ns;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de yield\n");
+    return -1;
+  }
+
+  nbyield = atoi(argv[1]);
+
+  err = thread_create(&th, thfunc, (void*) (intptr_t) nbyield);
+  assert(!err);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  for(i=0; i<nbyield; i++)
+    thread_yield();
+  clock_gettime(CLOCK_MONOTONIC, &ts2);
+
+  err = thread_join(th, NULL);
+  assert(!err);
+
+  ns = (ts2.tv_sec-ts1.tv_sec)*1e9 + (ts2.tv_nsec-ts1.tv_nsec);
+  printf("%d yield: %.1f ns par changement de contexte\n",
+         nbyield, ns / (2.0 * nbyield));
+
+  return 0;
+}
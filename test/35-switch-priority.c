@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test de l'ordonnancement par priorité.
+ *
+ * le main crée des threads de toutes les priorités, qui notent leur priorité
+ * à chaque fois qu'ils s'exécutent puis font des yield. un yield ne cède la
+ * main qu'aux threads de priorité supérieure ou égale: les priorités notées
+ * doivent donc être décroissantes. le dernier thread créé est ensuite monté
+ * à THREAD_PRIO_MAX alors qu'il attend déjà son tour, il doit passer en premier.
+ * le main passe à THREAD_PRIO_MIN avant de joindre les threads, pour ne pas
+ * leur transmettre sa priorité.
+ *
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_create_attr() avec une priorité
+ * - thread_yield()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_setpriority()/thread_getpriority()
+ */
+
+#define ROUNDS 3
+
+int *order;
+int next = 0;
+
+static void * thfunc(void *_id)
+{
+    int i, prio;
+
+    (void) _id;
+    for(i=0; i<ROUNDS; i++) {
+        thread_getpriority(thread_self(), &prio);
+        order[next++] = prio;
+        thread_yield();
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t *th;
+    thread_attr_t attr;
+    int i, err, nb, prio;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    th = malloc(nb * sizeof(*th));
+    order = malloc(nb * ROUNDS * sizeof(*order));
+    if (!th || !order) {
+        perror("malloc");
+        return -1;
+    }
+
+    thread_attr_init(&attr);
+    for(i=0; i<nb; i++) {
+        /* THREAD_PRIO_MAX est réservée au dernier thread */
+        err = thread_attr_setpriority(&attr, i % (THREAD_PRIO_MAX - THREAD_PRIO_MIN));
+        assert(!err);
+        err = thread_create_attr(&th[i], &attr, thfunc, NULL);
+        assert(!err);
+    }
+    thread_attr_destroy(&attr);
+
+    err = thread_setpriority(th[nb-1], THREAD_PRIO_MAX);
+    assert(!err);
+    err = thread_setpriority(th[nb-1], THREAD_PRIO_MAX + 1);
+    assert(err);
+    err = thread_getpriority(th[nb-1], &prio);
+    assert(!err && prio == THREAD_PRIO_MAX);
+
+    thread_setpriority(thread_self(), THREAD_PRIO_MIN);
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], NULL);
+        assert(!err);
+    }
+
+    if (order[0] != THREAD_PRIO_MAX) {
+        printf("ordre INCORRECT: le thread monté à THREAD_PRIO_MAX n'est pas passé en premier\n");
+        return EXIT_FAILURE;
+    }
+    for(i=1; i<nb * ROUNDS; i++) {
+        if (order[i] > order[i-1]) {
+            printf("ordre INCORRECT: priorité %d après %d\n", order[i], order[i-1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%d threads ordonnancés par priorité décroissante\n", nb);
+    free(order);
+    free(th);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test de l'équité de l'ordonnancement.
+ *
+ * des threads calculent par morceaux et font un yield après chaque morceau,
+ * le thread i faisant des morceaux i+1 fois plus longs que le thread 0.
+ * le main dort pendant 200 ms, puis arrête les threads et compare le travail
+ * fait par chacun. en FIFO, chaque thread calcule un morceau par tour et le
+ * thread i obtient i+1 fois plus de CPU que le thread 0. avec "fair" en second
+ * argument, la politique THREAD_SCHED_FAIR doit partager le CPU à peu près
+ * également: le thread le moins servi doit avoir au moins la moitié du travail
+ * du plus servi.
+ *
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_yield()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_sleep_ns()
+ * - thread_sched_config()
+ */
+
+#define UNIT 1000
+#define DURATION_NS 200000000ULL
+
+volatile int stop = 0;
+unsigned long *work;
+
+static void * thfunc(void *_id)
+{
+    int id = (intptr_t) _id;
+    volatile unsigned long sink = 0;
+    unsigned long i;
+
+    while (!stop) {
+        for(i=0; i<(unsigned long)(id+1)*UNIT; i++)
+            sink += i;
+        work[id] += id+1;
+        thread_yield();
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t *th;
+    unsigned long min, max;
+    int i, err, nb, fair;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    fair = argc > 2 && strcmp(argv[2], "fair") == 0;
+    if (fair) {
+        err = thread_sched_config(THREAD_SCHED_FAIR);
+        assert(!err);
+    }
+
+    th = malloc(nb * sizeof(*th));
+    work = calloc(nb, sizeof(*work));
+    if (!th || !work) {
+        perror("malloc");
+        return -1;
+    }
+
+    for(i=0; i<nb; i++) {
+        err = thread_create(&th[i], thfunc, (void*)((intptr_t)i));
+        assert(!err);
+    }
+
+    thread_sleep_ns(DURATION_NS);
+    stop = 1;
+
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], NULL);
+        assert(!err);
+    }
+
+    min = max = work[0];
+    for(i=1; i<nb; i++) {
+        if (work[i] < min)
+            min = work[i];
+        if (work[i] > max)
+            max = work[i];
+    }
+    printf("%d threads en %s: travail min %lu, max %lu, rapport %.2f\n",
+           nb, fair ? "fair" : "fifo", min, max, (double) min / max);
+
+    free(work);
+    free(th);
+
+    if (fair && 2 * min < max) {
+        printf("partage INCORRECT\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include "thread.h"
+
+/* test des statistiques de l'ordonnanceur.
+ *
+ * trois threads: l'un calcule pendant ms millisecondes, l'autre dort pendant
+ * ms millisecondes, le dernier attend un mutex que le main garde au moins ms
+ * millisecondes. chacun lit ses propres statistiques avant de se terminer: le
+ * temps d'exécution du premier, le temps bloqué des deux autres et l'attente
+ * de mutex du dernier doivent être comptés. le main lit aussi celles du
+ * dernier jusqu'à le trouver bloqué, et les statistiques globales pendant que
+ * les threads vivent puis une fois qu'ils sont tous joints.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_sleep_ns()
+ * - thread_mutex_lock()/thread_mutex_unlock()
+ * - thread_stats()/thread_stats_global()
+ */
+
+static uint64_t ms;
+static thread_mutex_t mutex;
+static thread_stats_t spin_stats, sleep_stats, mutex_stats;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void * spinner(void *arg)
+{
+  uint64_t end = now_ns() + ms * 1000000ULL;
+  (void)arg;
+
+  while (now_ns() < end)
+    ;
+  thread_stats(thread_self(), &spin_stats);
+  return NULL;
+}
+
+static void * sleeper(void *arg)
+{
+  (void)arg;
+  thread_sleep_ns(ms * 1000000ULL);
+  thread_stats(thread_self(), &sleep_stats);
+  return NULL;
+}
+
+static void * locker(void *arg)
+{
+  (void)arg;
+  thread_mutex_lock(&mutex);
+  thread_mutex_unlock(&mutex);
+  thread_stats(thread_self(), &mutex_stats);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t th[3];
+  thread_stats_t blocked = { 0 };
+  thread_global_stats_t during = { 0 }, after = { 0 };
+  uint64_t min;
+  int i, err, errors = 0;
+
+  if (argc < 2) {
+    printf("argument manquant: durée en millisecondes\n");
+    return -1;
+  }
+  ms = atoi(argv[1]);
+  /* une marge pour l'arrondi des horloges */
+  min = ms * 1000000ULL * 9 / 10;
+
+  thread_mutex_init(&mutex);
+  thread_mutex_lock(&mutex);
+  err = thread_create(&th[0], spinner, NULL);
+  assert(!err);
+  err = thread_create(&th[1], sleeper, NULL);
+  assert(!err);
+  err = thread_create(&th[2], locker, NULL);
+  assert(!err);
+
+  /* le dernier thread se bloque sur le mutex pendant que le main dort */
+  do {
+    thread_sleep_ns(ms * 1000000ULL);
+    err = thread_stats(th[2], &blocked);
+    assert(!err);
+  } while (blocked.mutex_contended == 0);
+  err = thread_stats_global(&during);
+  assert(!err);
+  thread_mutex_unlock(&mutex);
+
+  for(i=0; i<3; i++) {
+    err = thread_join(th[i], NULL);
+    assert(!err);
+  }
+  err = thread_stats_global(&after);
+  assert(!err);
+  thread_mutex_destroy(&mutex);
+
+  printf("calcul: %llu ns d'exécution, %llu changements volontaires, %llu préemptions\n",
+         (unsigned long long) spin_stats.run_ns, (unsigned long long) spin_stats.voluntary_switches,
+         (unsigned long long) spin_stats.involuntary_switches);
+  printf("sommeil: %llu ns bloqué, %llu ns d'exécution\n",
+         (unsigned long long) sleep_stats.blocked_ns, (unsigned long long) sleep_stats.run_ns);
+  printf("mutex: %llu attente(s), %llu ns bloqué (%llu ns vus par le main)\n",
+         (unsigned long long) mutex_stats.mutex_contended, (unsigned long long) mutex_stats.blocked_ns,
+         (unsigned long long) blocked.blocked_ns);
+  printf("global: %llu threads vivants puis %llu, %llu changements de contexte\n",
+         (unsigned long long) during.threads, (unsigned long long) after.threads,
+         (unsigned long long) after.switches);
+
+  if (spin_stats.run_ns < min)
+    errors++;
+  if (sleep_stats.blocked_ns < min || sleep_stats.voluntary_switches < 1 || sleep_stats.run_ns >= sleep_stats.blocked_ns)
+    errors++;
+  if (mutex_stats.mutex_contended != 1 || mutex_stats.blocked_ns < blocked.blocked_ns || blocked.blocked_ns == 0)
+    errors++;
+  /* le main et au moins le thread qui attend le mutex */
+  if (during.threads < 2 || after.threads != 1 || after.switches < during.switches || after.switches == 0)
+    errors++;
+
+  if (errors) {
+    printf("statistiques INCORRECTES\n");
+    return EXIT_FAILURE;
+  }
+  printf("statistiques correctes\n");
+  return EXIT_SUCCESS;
+}
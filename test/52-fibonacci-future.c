@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/time.h>
+#include "thread.h"
+
+/* fibonacci avec des futures.
+ *
+ * comme 51-fibonacci, mais chaque calcul lance ses deux sous-calculs avec
+ * thread_async() et attend leurs valeurs avec thread_future_wait_all().
+ * le résultat est ensuite passé dans une chaîne de CHAIN continuations qui
+ * ajoutent chacune 1, accrochées avant et après qu'il soit prêt.
+ * enfin, des promesses remplies par un autre thread dans l'ordre inverse
+ * doivent être trouvées prêtes une à une par thread_future_wait_any().
+ *
+ * la durée doit être proportionnel à la valeur du résultat.
+ * valgrind doit être content.
+ *
+ * support nécessaire:
+ * - thread_async()
+ * - thread_future_get()/thread_future_wait_all()/thread_future_wait_any()
+ * - thread_future_then()
+ * - thread_future_create()/thread_future_set()/thread_future_destroy()
+ */
+
+#define CHAIN 10
+#define PROMISES 10
+
+static void * fibo(void *_value)
+{
+  thread_future_t f[2];
+  void *res = NULL, *res2 = NULL;
+  unsigned long value = (unsigned long) _value;
+  int err;
+
+  /* on passe un peu la main aux autres pour eviter de faire uniquement la partie gauche de l'arbre */
+  thread_yield();
+
+  if (value < 3)
+    return (void*) 1;
+
+  err = thread_async(&f[0], fibo, (void*)(value-1));
+  assert(!err);
+  err = thread_async(&f[1], fibo, (void*)(value-2));
+  assert(!err);
+
+  err = thread_future_wait_all(f, 2);
+  assert(!err);
+  err = thread_future_get(f[0], &res);
+  assert(!err);
+  err = thread_future_get(f[1], &res2);
+  assert(!err);
+  thread_future_destroy(f[0]);
+  thread_future_destroy(f[1]);
+
+  return (void*)((unsigned long) res + (unsigned long) res2);
+}
+
+static void * incr(void *value)
+{
+  return (void*)((unsigned long) value + 1);
+}
+
+static void * setter(void *_promises)
+{
+  thread_future_t *promises = _promises;
+  int i;
+
+  for(i=PROMISES-1; i>=0; i--) {
+    thread_yield();
+    thread_future_set(promises[i], (void*)(intptr_t) i);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_future_t root, chain[CHAIN], promises[PROMISES], pending[PROMISES], th;
+  unsigned long value, res, chained;
+  struct timeval tv1, tv2;
+  void *v;
+  double s;
+  int i, err, ready;
+
+  if (argc < 2) {
+    printf("argument manquant: entier x pour lequel calculer fibonacci(x)\n");
+    return -1;
+  }
+
+  value = atoi(argv[1]);
+  gettimeofday(&tv1, NULL);
+  err = thread_async(&root, fibo, (void *)value);
+  assert(!err);
+  /* la moitié des continuations est accrochée avant que root soit prêt */
+  err = thread_future_then(&chain[0], root, incr);
+  assert(!err);
+  for(i=1; i<CHAIN/2; i++) {
+    err = thread_future_then(&chain[i], chain[i-1], incr);
+    assert(!err);
+  }
+  err = thread_future_get(root, &v);
+  assert(!err);
+  res = (unsigned long) v;
+  gettimeofday(&tv2, NULL);
+  s = (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec) * 1e-6;
+  for(; i<CHAIN; i++) {
+    err = thread_future_then(&chain[i], chain[i-1], incr);
+    assert(!err);
+  }
+  err = thread_future_get(chain[CHAIN-1], &v);
+  assert(!err);
+  chained = (unsigned long) v;
+
+  printf("fibo de %ld = %ld en %e s\n", value, res, s);
+
+  /* les promesses sont remplies dans l'ordre inverse, celles trouvées prêtes
+   * sont retirées des promesses attendues */
+  for(i=0; i<PROMISES; i++) {
+    err = thread_future_create(&promises[i]);
+    assert(!err);
+    pending[i] = promises[i];
+  }
+  err = thread_async(&th, setter, promises);
+  assert(!err);
+  for(i=PROMISES; i>0; i--) {
+    ready = thread_future_wait_any(pending, i);
+    assert(ready >= 0 && ready < i);
+    err = thread_future_get(pending[ready], &v);
+    assert(!err);
+    if (promises[(intptr_t) v] != pending[ready]) {
+      printf("wait_any INCORRECT: promesse %ld mal remplie\n", (long)(intptr_t) v);
+      return EXIT_FAILURE;
+    }
+    pending[ready] = pending[i-1];
+  }
+  err = thread_future_set(promises[0], NULL);
+  assert(err);
+  thread_future_get(th, NULL);
+
+  thread_future_destroy(th);
+  for(i=0; i<PROMISES; i++)
+    thread_future_destroy(promises[i]);
+  thread_future_destroy(root);
+  for(i=0; i<CHAIN; i++)
+    thread_future_destroy(chain[i]);
+
+  if (chained != res + CHAIN) {
+    printf("continuations INCORRECTES: %ld au lieu de %ld\n", chained, res + CHAIN);
+    return EXIT_FAILURE;
+  }
+  printf("%d continuations enchaînées, %d promesses attendues\n", CHAIN, PROMISES);
+  return 0;
+}
@@ -0,0 +1,32 @@
+#include <stdint.h>
+#include <assert.h>
+#include "thread.h"
+
+/* seconde unité de compilation de 53-future-units.c: remplit les futures */
+
+static thread_future_t *set_futures;
+static int set_n;
+
+static void * setter(void *arg)
+{
+  int i;
+
+  (void)arg;
+  for (i = set_n - 1; i >= 0; i--) {
+    thread_yield();
+    thread_future_set(set_futures[i], (void *)(intptr_t)i);
+  }
+  return NULL;
+}
+
+thread_t future_units_start(thread_future_t *futures, int n)
+{
+  thread_t th;
+  int err;
+
+  set_futures = futures;
+  set_n = n;
+  err = thread_create(&th, setter, NULL);
+  assert(!err);
+  return th;
+}
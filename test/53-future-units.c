@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include "thread.h"
+
+/* futures partagés entre deux unités de compilation.
+ *
+ * le main crée NB promesses et les passe à future_units_start(), définie
+ * dans 53-future-units-set.c, qui lance un thread les remplissant dans
+ * l'ordre inverse. le main les attend avec thread_future_wait_any() puis
+ * thread_future_wait_all(): les réveils doivent traverser les unités de
+ * compilation, sans quoi le main reste bloqué.
+ *
+ * support nécessaire:
+ * - thread_create()/thread_join()
+ * - thread_future_create()/thread_future_set()/thread_future_destroy()
+ * - thread_future_wait_any()/thread_future_wait_all()/thread_future_get()
+ */
+
+#define NB 10
+
+/* dans 53-future-units-set.c */
+thread_t future_units_start(thread_future_t *futures, int n);
+
+int main(void)
+{
+  thread_future_t futures[NB];
+  thread_t th;
+  void *value;
+  int i, err, sum = 0;
+
+  for (i = 0; i < NB; i++) {
+    err = thread_future_create(&futures[i]);
+    assert(!err);
+  }
+
+  th = future_units_start(futures, NB);
+  /* la dernière est remplie en premier */
+  err = thread_future_wait_any(futures, NB);
+  assert(err >= 0);
+  err = thread_future_wait_all(futures, NB);
+  assert(!err);
+  err = thread_join(th, NULL);
+  assert(!err);
+
+  for (i = 0; i < NB; i++) {
+    err = thread_future_get(futures[i], &value);
+    assert(!err);
+    sum += (intptr_t)value;
+    err = thread_future_destroy(futures[i]);
+    assert(!err);
+  }
+
+  printf("%d futures remplis dans une autre unité, somme %d\n", NB, sum);
+  return sum == NB * (NB - 1) / 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
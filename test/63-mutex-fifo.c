@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test de l'équité du mutex: les threads bloqués l'obtiennent dans leur ordre d'arrivée.
+ *
+ * le main verrouille le mutex, puis crée les threads qui se bloquent dessus
+ * l'un après l'autre. à chaque déverrouillage, le mutex doit passer au
+ * premier thread en attente, même si d'autres threads le redemandent entre temps.
+ *
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_yield()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_mutex_init()
+ * - thread_mutex_destroy()
+ * - thread_mutex_lock()
+ * - thread_mutex_unlock()
+ */
+
+#define ROUNDS 10
+
+thread_mutex_t lock;
+int *order;
+int next = 0;
+
+static void * thfunc(void *_id)
+{
+    int id = (intptr_t) _id;
+    int i;
+
+    for(i=0; i<ROUNDS; i++) {
+        thread_mutex_lock(&lock);
+        order[next++] = id;
+        thread_mutex_unlock(&lock);
+        /* on redemande le mutex aussitôt, on doit repasser derrière les autres */
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t *th;
+    int i, err, nb;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    th = malloc(nb * sizeof(*th));
+    order = malloc(nb * ROUNDS * sizeof(*order));
+    if (!th || !order) {
+        perror("malloc");
+        return -1;
+    }
+
+    thread_mutex_init(&lock);
+    thread_mutex_lock(&lock);
+
+    /* chaque thread se bloque sur le mutex avant que le suivant soit créé */
+    for(i=0; i<nb; i++) {
+        err = thread_create(&th[i], thfunc, (void*)((intptr_t)i));
+        assert(!err);
+        thread_yield();
+    }
+
+    thread_mutex_unlock(&lock);
+
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], NULL);
+        assert(!err);
+    }
+
+    thread_mutex_destroy(&lock);
+
+    for(i=0; i<nb * ROUNDS; i++) {
+        if (order[i] != i % nb) {
+            printf("ordre INCORRECT: le thread %d a eu le mutex en position %d\n", order[i], i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%d threads ont eu le mutex %d fois dans l'ordre d'arrivée\n", nb, ROUNDS);
+    free(order);
+    free(th);
+    return EXIT_SUCCESS;
+}
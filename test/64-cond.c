@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test des variables de condition: producteurs/consommateurs sur un tampon borné.
+ *
+ * nb producteurs déposent chacun ITEMS entiers dans un tampon de SLOTS cases,
+ * nb consommateurs les retirent; les threads bloqués attendent sur une
+ * condition au lieu de boucler avec thread_yield().
+ * la somme des entiers retirés doit être égale à celle des entiers déposés.
+ * puis un thread_cond_timedwait() sans signal doit renvoyer ETIMEDOUT.
+ *
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() avec récupération de la valeur de retour
+ * - thread_mutex_lock()/thread_mutex_unlock()
+ * - thread_cond_init()/thread_cond_destroy()
+ * - thread_cond_wait()/thread_cond_timedwait()
+ * - thread_cond_signal()/thread_cond_broadcast()
+ */
+
+#define SLOTS 16
+#define ITEMS 1000
+
+thread_mutex_t lock;
+thread_cond_t not_full, not_empty;
+unsigned long buffer[SLOTS];
+int count = 0, head = 0, producers;
+
+static void * producer(void *_id)
+{
+    unsigned long id = (intptr_t) _id;
+    unsigned long i;
+
+    for(i=0; i<ITEMS; i++) {
+        thread_mutex_lock(&lock);
+        while (count == SLOTS)
+            thread_cond_wait(&not_full, &lock);
+        buffer[(head + count++) % SLOTS] = id * ITEMS + i;
+        thread_cond_signal(&not_empty);
+        thread_mutex_unlock(&lock);
+    }
+
+    /* le dernier producteur réveille tous les consommateurs pour qu'ils terminent */
+    thread_mutex_lock(&lock);
+    if (--producers == 0)
+        thread_cond_broadcast(&not_empty);
+    thread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+static void * consumer(void *dummy __attribute__((unused)))
+{
+    unsigned long sum = 0;
+
+    thread_mutex_lock(&lock);
+    for(;;) {
+        while (count == 0 && producers > 0)
+            thread_cond_wait(&not_empty, &lock);
+        if (count == 0)
+            break;
+        sum += buffer[head];
+        head = (head + 1) % SLOTS;
+        count--;
+        thread_cond_signal(&not_full);
+    }
+    thread_mutex_unlock(&lock);
+
+    return (void *) sum;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t *prod, *cons;
+    unsigned long sum = 0, expected;
+    struct timeval tv;
+    struct timespec abstime;
+    void *res;
+    int i, err, nb;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de producteurs et de consommateurs\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    producers = nb;
+    prod = malloc(nb * sizeof(*prod));
+    cons = malloc(nb * sizeof(*cons));
+    if (!prod || !cons) {
+        perror("malloc");
+        return -1;
+    }
+
+    thread_mutex_init(&lock);
+    thread_cond_init(&not_full);
+    thread_cond_init(&not_empty);
+
+    for(i=0; i<nb; i++) {
+        err = thread_create(&cons[i], consumer, NULL);
+        assert(!err);
+        err = thread_create(&prod[i], producer, (void*)((intptr_t)i));
+        assert(!err);
+    }
+
+    for(i=0; i<nb; i++) {
+        err = thread_join(prod[i], NULL);
+        assert(!err);
+        err = thread_join(cons[i], &res);
+        assert(!err);
+        sum += (unsigned long) res;
+    }
+
+    /* somme des entiers de 0 à nb*ITEMS-1 */
+    expected = (unsigned long) nb * ITEMS * ((unsigned long) nb * ITEMS - 1) / 2;
+    if (sum != expected) {
+        printf("somme INCORRECTE: %lu != %lu\n", sum, expected);
+        return EXIT_FAILURE;
+    }
+
+    /* personne ne signale la condition: l'attente doit expirer après 10ms */
+    gettimeofday(&tv, NULL);
+    abstime.tv_sec = tv.tv_sec;
+    abstime.tv_nsec = tv.tv_usec * 1000 + 10 * 1000 * 1000;
+    if (abstime.tv_nsec >= 1000000000) {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000;
+    }
+    thread_mutex_lock(&lock);
+    err = thread_cond_timedwait(&not_empty, &lock, &abstime);
+    thread_mutex_unlock(&lock);
+    if (err != ETIMEDOUT) {
+        printf("thread_cond_timedwait n'a pas expiré: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    thread_cond_destroy(&not_full);
+    thread_cond_destroy(&not_empty);
+    thread_mutex_destroy(&lock);
+    free(prod);
+    free(cons);
+
+    printf("%d producteurs et %d consommateurs: somme %lu correcte, timedwait expiré\n", nb, nb, sum);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test des sémaphores: une porte qui limite le nombre de threads concurrents.
+ *
+ * nb threads passent ROUNDS fois par une section gardée par un sémaphore de
+ * TOKENS jetons, en cédant la main à l'intérieur; il ne doit jamais y avoir
+ * plus de TOKENS threads dans la section à la fois.
+ * thread_sem_trywait() doit échouer sur un sémaphore vide sans bloquer.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_yield()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_sem_init()/thread_sem_destroy()
+ * - thread_sem_wait()/thread_sem_trywait()/thread_sem_post()
+ */
+
+#define TOKENS 4
+#define ROUNDS 100
+
+thread_sem_t gate;
+int inside = 0, max_inside = 0;
+
+static void * thfunc(void *dummy __attribute__((unused)))
+{
+    int i, n;
+
+    for(i=0; i<ROUNDS; i++) {
+        thread_sem_wait(&gate);
+        n = __sync_add_and_fetch(&inside, 1);
+        if (n > max_inside)
+            max_inside = n;
+        thread_yield();
+        __sync_sub_and_fetch(&inside, 1);
+        thread_sem_post(&gate);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t *th;
+    thread_sem_t empty;
+    struct timeval tv1, tv2;
+    unsigned long us;
+    int i, err, nb;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    th = malloc(nb * sizeof(*th));
+    if (!th) {
+        perror("malloc");
+        return -1;
+    }
+
+    /* un sémaphore vide ne donne pas de jeton, jusqu'au premier post */
+    err = thread_sem_init(&empty, 0);
+    assert(!err);
+    if (thread_sem_trywait(&empty) != -1 || errno != EAGAIN) {
+        printf("thread_sem_trywait a pris un jeton INEXISTANT\n");
+        return EXIT_FAILURE;
+    }
+    thread_sem_post(&empty);
+    if (thread_sem_trywait(&empty) != 0) {
+        printf("thread_sem_trywait n'a PAS pris le jeton posté\n");
+        return EXIT_FAILURE;
+    }
+    thread_sem_destroy(&empty);
+
+    err = thread_sem_init(&gate, TOKENS);
+    assert(!err);
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<nb; i++) {
+        err = thread_create(&th[i], thfunc, NULL);
+        assert(!err);
+    }
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], NULL);
+        assert(!err);
+    }
+    gettimeofday(&tv2, NULL);
+    us = (tv2.tv_sec-tv1.tv_sec)*1000000+(tv2.tv_usec-tv1.tv_usec);
+
+    thread_sem_destroy(&gate);
+    free(th);
+
+    if (max_inside > TOKENS) {
+        printf("%d threads dans la section, plus que les %d jetons\n", max_inside, TOKENS);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d threads passés %d fois avec au plus %d jetons en %lu us\n", nb, ROUNDS, TOKENS, us);
+    return EXIT_SUCCESS;
+}
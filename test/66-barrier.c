@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test des barrières: nb threads avancent ensemble de phase en phase.
+ *
+ * chaque thread note sa phase avant d'attendre la barrière; une fois la
+ * barrière franchie, son voisin doit avoir atteint la même phase.
+ * à chaque phase, un seul thread doit recevoir THREAD_BARRIER_SERIAL_THREAD.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_barrier_init()/thread_barrier_destroy()
+ * - thread_barrier_wait()
+ */
+
+#define PHASES 100
+
+thread_barrier_t barrier;
+volatile int *phase;
+int nb, serial = 0, errors = 0;
+
+static void * thfunc(void *_id)
+{
+    int id = (intptr_t) _id;
+    int p;
+
+    for(p=0; p<PHASES; p++) {
+        phase[id] = p;
+        if (thread_barrier_wait(&barrier) == THREAD_BARRIER_SERIAL_THREAD)
+            __sync_add_and_fetch(&serial, 1);
+
+        /* le voisin doit avoir atteint la phase, il a même pu passer à la suivante */
+        if (phase[(id + 1) % nb] < p)
+            __sync_add_and_fetch(&errors, 1);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t *th;
+    struct timeval tv1, tv2;
+    unsigned long us;
+    int i, err;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    th = malloc(nb * sizeof(*th));
+    phase = malloc(nb * sizeof(*phase));
+    if (!th || !phase) {
+        perror("malloc");
+        return -1;
+    }
+    for(i=0; i<nb; i++)
+        phase[i] = -1;
+
+    err = thread_barrier_init(&barrier, nb);
+    assert(!err);
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<nb; i++) {
+        err = thread_create(&th[i], thfunc, (void*)((intptr_t)i));
+        assert(!err);
+    }
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], NULL);
+        assert(!err);
+    }
+    gettimeofday(&tv2, NULL);
+    us = (tv2.tv_sec-tv1.tv_sec)*1000000+(tv2.tv_usec-tv1.tv_usec);
+
+    thread_barrier_destroy(&barrier);
+    free((void *) phase);
+    free(th);
+
+    if (errors != 0 || serial != PHASES) {
+        printf("barrière INCORRECTE: %d threads en retard, %d threads série pour %d phases\n", errors, serial, PHASES);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d threads synchronisés %d fois par la barrière en %lu us\n", nb, PHASES, us);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test et mesure du verrou lecteurs/rédacteur sur une table lue très souvent.
+ *
+ * nb threads font ROUNDS accès à une table, dont une écriture toutes les
+ * READS lectures; la lecture et l'écriture cèdent la main au milieu.
+ * un lecteur ne doit jamais voir une écriture à moitié faite.
+ * la même charge est mesurée avec un mutex puis avec le verrou: les lecteurs
+ * ne doivent plus s'attendre entre eux.
+ * sans pthread, un lecteur ne doit pas passer devant un rédacteur en attente.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_yield()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_mutex_lock()/thread_mutex_unlock()
+ * - thread_rwlock_init()/thread_rwlock_destroy()
+ * - thread_rwlock_rdlock()/thread_rwlock_wrlock()/thread_rwlock_unlock()
+ * - thread_rwlock_tryrdlock()
+ */
+
+#define ROUNDS 1000
+#define READS 100
+#define ENTRIES 16
+
+thread_mutex_t mutex;
+thread_rwlock_t rwlock;
+volatile int table[ENTRIES];
+int use_rwlock, torn = 0;
+
+static void read_lock(void)
+{
+    if (use_rwlock)
+        thread_rwlock_rdlock(&rwlock);
+    else
+        thread_mutex_lock(&mutex);
+}
+
+static void write_lock(void)
+{
+    if (use_rwlock)
+        thread_rwlock_wrlock(&rwlock);
+    else
+        thread_mutex_lock(&mutex);
+}
+
+static void unlock(void)
+{
+    if (use_rwlock)
+        thread_rwlock_unlock(&rwlock);
+    else
+        thread_mutex_unlock(&mutex);
+}
+
+static void * thfunc(void *_id)
+{
+    int id = (intptr_t) _id;
+    int i, j, first;
+
+    for(i=0; i<ROUNDS; i++) {
+        if ((i + id) % READS == 0) {
+            write_lock();
+            for(j=0; j<ENTRIES; j++) {
+                table[j] = table[j] + 1;
+                if (j == ENTRIES / 2)
+                    thread_yield();
+            }
+            unlock();
+        } else {
+            read_lock();
+            first = table[0];
+            thread_yield();
+            for(j=1; j<ENTRIES; j++)
+                if (table[j] != first)
+                    __sync_add_and_fetch(&torn, 1);
+            unlock();
+        }
+    }
+
+    return NULL;
+}
+
+/* lance nb threads sur la table et renvoie la durée en us */
+static unsigned long run(int nb, thread_t *th)
+{
+    struct timeval tv1, tv2;
+    int i, err;
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<nb; i++) {
+        err = thread_create(&th[i], thfunc, (void*)((intptr_t)i));
+        assert(!err);
+    }
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], NULL);
+        assert(!err);
+    }
+    gettimeofday(&tv2, NULL);
+
+    return (tv2.tv_sec-tv1.tv_sec)*1000000+(tv2.tv_usec-tv1.tv_usec);
+}
+
+#ifndef USE_PTHREAD
+static void * writer(void *dummy __attribute__((unused)))
+{
+    thread_rwlock_wrlock(&rwlock);
+    thread_rwlock_unlock(&rwlock);
+    return NULL;
+}
+
+/* un rédacteur attend la fin d'une lecture: un nouveau lecteur doit attendre aussi */
+static int writer_preferred(void)
+{
+    thread_t th;
+    int err, ok;
+
+    thread_rwlock_rdlock(&rwlock);
+    err = thread_create(&th, writer, NULL);
+    assert(!err);
+    while (__atomic_load_n(&rwlock.writers.tqh_first, __ATOMIC_ACQUIRE) == NULL)
+        thread_yield(); /* le rédacteur n'attend pas encore */
+
+    ok = thread_rwlock_tryrdlock(&rwlock) != 0;
+    thread_rwlock_unlock(&rwlock);
+    err = thread_join(th, NULL);
+    assert(!err);
+
+    return ok;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    thread_t *th;
+    unsigned long us_mutex, us_rwlock;
+    int nb;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+
+    nb = atoi(argv[1]);
+    th = malloc(nb * sizeof(*th));
+    if (!th) {
+        perror("malloc");
+        return -1;
+    }
+
+    thread_mutex_init(&mutex);
+    thread_rwlock_init(&rwlock);
+
+    use_rwlock = 0;
+    us_mutex = run(nb, th);
+    use_rwlock = 1;
+    us_rwlock = run(nb, th);
+
+#ifndef USE_PTHREAD
+    if (!writer_preferred()) {
+        printf("un lecteur est passé devant un rédacteur en attente\n");
+        return EXIT_FAILURE;
+    }
+#endif
+
+    thread_rwlock_destroy(&rwlock);
+    thread_mutex_destroy(&mutex);
+    free(th);
+
+    if (torn != 0) {
+        printf("%d lectures ont vu une écriture INCOMPLETE\n", torn);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d threads, %d lectures par écriture: mutex en %lu us, rwlock en %lu us\n",
+           nb, READS, us_mutex, us_rwlock);
+    return EXIT_SUCCESS;
+}
@@ -25,6 +25,8 @@ static void * thfunc( void *arg )
 
     for(i=0; i<100;i++) {
 	for(j=0; j<10000000;j++) {
+	    /* empêche le compilateur de supprimer la boucle en -O2 */
+	    __asm__ volatile("" ::: "memory");
 	}
 	fprintf(stderr, "%ld ", (intptr_t)arg );
     }
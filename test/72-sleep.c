@@ -0,0 +1,161 @@
+#define _GNU_SOURCE // pthread_timedjoin_np() avec -DUSE_PTHREAD
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test des attentes temporisées: nb threads dorment en même temps.
+ *
+ * chaque thread s'endort ROUNDS fois jusqu'à une échéance tirée entre 1 et
+ * MAX_DELAY_MS ms plus tard, et mesure son retard au réveil. aucun ne doit être
+ * réveillé en avance. le programme affiche le retard moyen, le 99e centile et le
+ * maximum. avant cela, thread_timedjoin() sur un thread endormi et
+ * thread_mutex_timedlock() sur un mutex tenu par un thread endormi doivent expirer.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join()
+ * - thread_timedjoin()
+ * - thread_sleep_ns()/thread_sleep_until()
+ * - thread_mutex_timedlock()
+ */
+
+#define ROUNDS 5
+#define MAX_DELAY_MS 10
+
+uint64_t *lateness;
+thread_mutex_t lock;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* heure absolue dans ms millisecondes, pour les fonctions temporisées */
+static struct timespec abstime_in(long ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static void * sleeper(void *_id)
+{
+    int id = (intptr_t) _id;
+    unsigned int seed = id;
+    uint64_t deadline, now;
+    int i;
+
+    for(i=0; i<ROUNDS; i++) {
+        deadline = now_ns() + (1 + rand_r(&seed) % MAX_DELAY_MS) * 1000000ULL;
+        thread_sleep_until(deadline);
+        now = now_ns();
+        if (now < deadline)
+            return (void *) -1;
+        lateness[id * ROUNDS + i] = now - deadline;
+    }
+    return NULL;
+}
+
+static void * holder(void *dummy __attribute__((unused)))
+{
+    thread_mutex_lock(&lock);
+    thread_sleep_ns(50 * 1000000ULL);
+    thread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static int cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t th, *ths;
+    struct timespec ts;
+    uint64_t start, sum = 0;
+    void *res;
+    int i, err, nb, early = 0;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+    nb = atoi(argv[1]);
+
+    /* le thread tient le mutex en dormant 50 ms: les deux attentes de 5 ms expirent */
+    thread_mutex_init(&lock);
+    err = thread_create(&th, holder, NULL);
+    assert(!err);
+    thread_sleep_ns(1000000);
+    ts = abstime_in(5);
+    if (thread_mutex_timedlock(&lock, &ts) != ETIMEDOUT) {
+        printf("thread_mutex_timedlock n'a pas expiré\n");
+        return EXIT_FAILURE;
+    }
+    ts = abstime_in(5);
+    if (thread_timedjoin(th, NULL, &ts) != ETIMEDOUT) {
+        printf("thread_timedjoin n'a pas expiré\n");
+        return EXIT_FAILURE;
+    }
+    ts = abstime_in(1000);
+    err = thread_mutex_timedlock(&lock, &ts);
+    assert(!err);
+    thread_mutex_unlock(&lock);
+    err = thread_join(th, NULL);
+    assert(!err);
+    thread_mutex_destroy(&lock);
+
+    ths = malloc(nb * sizeof(*ths));
+    lateness = malloc(nb * ROUNDS * sizeof(*lateness));
+    if (!ths || !lateness) {
+        perror("malloc");
+        return -1;
+    }
+
+    start = now_ns();
+    for(i=0; i<nb; i++) {
+        err = thread_create(&ths[i], sleeper, (void*)((intptr_t)i));
+        assert(!err);
+    }
+    for(i=0; i<nb; i++) {
+        err = thread_join(ths[i], &res);
+        assert(!err);
+        if (res != NULL)
+            early++;
+    }
+
+    if (early) {
+        printf("%d threads réveillés en avance\n", early);
+        return EXIT_FAILURE;
+    }
+
+    for(i=0; i<nb * ROUNDS; i++)
+        sum += lateness[i];
+    qsort(lateness, nb * ROUNDS, sizeof(*lateness), cmp);
+
+    printf("%d threads endormis %d fois: retard moyen %lu us, p99 %lu us, max %lu us, en %lu us (timedjoin et timedlock expirés)\n",
+           nb, ROUNDS, (unsigned long) (sum / (nb * ROUNDS) / 1000),
+           (unsigned long) (lateness[(nb * ROUNDS) * 99 / 100] / 1000),
+           (unsigned long) (lateness[nb * ROUNDS - 1] / 1000),
+           (unsigned long) ((now_ns() - start) / 1000));
+    free(lateness);
+    free(ths);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test de l'attente des threads noyau sans thread à exécuter.
+ *
+ * le main dort nb fois SLEEP_US us: le processus n'a alors plus rien à
+ * exécuter et attend l'échéance dans le noyau, ou en attente active avec
+ * THREAD_IDLE_SPIN_US. puis deux threads se renvoient nb fois la main avec
+ * des sémaphores (en M:N, le réveil peut viser un thread noyau endormi).
+ * le programme affiche le retard moyen des réveils, la durée d'un aller-retour
+ * et le temps CPU consommé par rapport au temps écoulé.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre d'itérations donné en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join()
+ * - thread_sleep_until()
+ * - thread_sem_init()/thread_sem_wait()/thread_sem_post()
+ * - thread_idle_config() (ou THREAD_IDLE_SPIN_US)
+ */
+
+#define SLEEP_US 50
+
+int nb;
+thread_sem_t ping, pong;
+
+static uint64_t now_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void * ponger(void *dummy __attribute__((unused)))
+{
+    int i;
+
+    for(i=0; i<nb; i++) {
+        thread_sem_wait(&ping);
+        thread_sem_post(&pong);
+    }
+    return NULL;
+}
+
+static void * pinger(void *dummy __attribute__((unused)))
+{
+    int i;
+
+    for(i=0; i<nb; i++) {
+        thread_sem_post(&ping);
+        thread_sem_wait(&pong);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t th1, th2;
+    uint64_t start, cpu, deadline, now, late = 0, pingpong;
+    int i, err;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre d'itérations\n");
+        return -1;
+    }
+    nb = atoi(argv[1]);
+
+    start = now_ns(CLOCK_MONOTONIC);
+    cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    for(i=0; i<nb; i++) {
+        deadline = now_ns(CLOCK_MONOTONIC) + SLEEP_US * 1000;
+        thread_sleep_until(deadline);
+        now = now_ns(CLOCK_MONOTONIC);
+        assert(now >= deadline);
+        late += now - deadline;
+    }
+
+    thread_sem_init(&ping, 0);
+    thread_sem_init(&pong, 0);
+    pingpong = now_ns(CLOCK_MONOTONIC);
+    err = thread_create(&th1, ponger, NULL);
+    assert(!err);
+    err = thread_create(&th2, pinger, NULL);
+    assert(!err);
+    thread_join(th2, NULL);
+    thread_join(th1, NULL);
+    now = now_ns(CLOCK_MONOTONIC);
+    pingpong = now - pingpong;
+    thread_sem_destroy(&ping);
+    thread_sem_destroy(&pong);
+
+    printf("%d sommeils de %d us: retard moyen %lu ns, %d allers-retours de %lu ns, CPU %lu %%\n",
+           nb, SLEEP_US, (unsigned long) (late / nb), nb, (unsigned long) (pingpong / nb),
+           (unsigned long) ((now_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu) * 100 / (now - start)));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test de detection d'un deadlock sur un cycle de mutex.
+ *
+ * nb threads verrouillent chacun leur mutex, s'attendent à une barrière, puis
+ * verrouillent le mutex du thread suivant. le thread qui ferme le cycle doit
+ * recevoir EDEADLK (en M:N, plusieurs peuvent le fermer en même temps), et le
+ * hook doit recevoir un cycle de nb threads commençant par lui. les threads
+ * qui ont échoué libèrent leur mutex, ce qui débloque les autres.
+ * un thread qui se joint lui-même doit aussi recevoir -1 et EDEADLK.
+ *
+ * valgrind doit etre content.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() sans récupération de la valeur de retour
+ * - thread_mutex_lock()/thread_mutex_unlock()
+ * - thread_barrier_wait()
+ * - thread_deadlock_config()
+ */
+
+thread_mutex_t *mutex;
+thread_barrier_t barrier;
+int nb, deadlocks = 0, hooked = 0, errors = 0;
+
+static void hook(const thread_t *cycle, int len)
+{
+  if (len != nb || cycle[0] != thread_self())
+    __sync_fetch_and_add(&errors, 1);
+  __sync_fetch_and_add(&hooked, 1);
+}
+
+static void * thfunc(void *_id)
+{
+  int id = (intptr_t) _id;
+  int err;
+
+  err = thread_mutex_lock(&mutex[id]);
+  assert(!err);
+  thread_barrier_wait(&barrier);
+
+  err = thread_mutex_lock(&mutex[(id + 1) % nb]);
+  if (err == EDEADLK) {
+    __sync_fetch_and_add(&deadlocks, 1);
+  } else {
+    assert(!err);
+    thread_mutex_unlock(&mutex[(id + 1) % nb]);
+  }
+  thread_mutex_unlock(&mutex[id]);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th;
+  int i, err;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+
+  th = malloc(nb * sizeof(*th));
+  mutex = malloc(nb * sizeof(*mutex));
+  if (!th || !mutex) {
+    perror("malloc");
+    return -1;
+  }
+
+  err = thread_join(thread_self(), NULL);
+  assert(err == -1 && errno == EDEADLK);
+
+  thread_deadlock_config(hook);
+
+  for(i=0; i<nb; i++)
+    thread_mutex_init(&mutex[i]);
+  thread_barrier_init(&barrier, nb);
+
+  for(i=0; i<nb; i++) {
+    err = thread_create(&th[i], thfunc, (void*)((intptr_t)i));
+    assert(!err);
+  }
+  for(i=0; i<nb; i++) {
+    err = thread_join(th[i], NULL);
+    assert(!err);
+  }
+
+  for(i=0; i<nb; i++)
+    thread_mutex_destroy(&mutex[i]);
+  thread_barrier_destroy(&barrier);
+  free(mutex);
+  free(th);
+
+  printf("%d threads en cycle sur des mutex: %d interblocage(s) détecté(s)\n", nb, deadlocks);
+  if (deadlocks < 1 || hooked != deadlocks || errors) {
+    printf("détection INCORRECTE\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test de la fin du programme quand plus aucun thread ne peut s'exécuter.
+ *
+ * nb threads se terminent pendant que le main attend un sémaphore que
+ * personne ne postera. une fois le dernier terminé, thread_sem_wait() ne
+ * doit pas rendre la main: la bibliothèque doit signaler l'interblocage et
+ * terminer le programme en échec.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_sem_init()/thread_sem_wait()
+ */
+
+static void * thfunc(void *arg)
+{
+  thread_yield();
+  return arg;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_sem_t sem;
+  thread_t th;
+  int i, err, nb;
+
+  if (argc < 2) {
+    printf("argument manquant: nombre de threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+
+  err = thread_sem_init(&sem, 0);
+  assert(!err);
+  for (i = 0; i < nb; i++) {
+    err = thread_create(&th, thfunc, NULL);
+    assert(!err);
+  }
+
+  printf("le main attend un sémaphore que personne ne postera\n");
+  fflush(stdout);
+  err = thread_sem_wait(&sem);
+  printf("thread_sem_wait a rendu %d sans jeton\n", err);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test des entrées/sorties: un serveur d'écho sur la boucle locale.
+ *
+ * un thread accepte nb connexions et lance un thread d'écho par connexion;
+ * nb threads clients se connectent, envoient ROUNDS messages et vérifient
+ * l'écho de chacun, la moitié avec une socket rendue non bloquante avant
+ * thread_connect(). tous partagent le même thread noyau (en 1:N): une lecture
+ * qui bloquerait le processus entier ferait attendre les clients pour toujours.
+ * avant cela, thread_poll() sur un tube vide doit expirer, comme sur un
+ * descripteur négatif qu'il ignore, puis thread_poll() sur le tube donné deux
+ * fois et un thread_read() bloqué doivent être réveillés par l'écriture d'un
+ * autre thread, sans laisser le tube en mode non bloquant.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() avec récupération de la valeur de retour
+ * - thread_read()/thread_write()
+ * - thread_accept()/thread_connect()
+ * - thread_poll()
+ */
+
+#define ROUNDS 10
+#define MSG_SIZE 64
+
+int nb, pipefd[2];
+struct sockaddr_in server_addr;
+thread_t *echo_th;
+
+/* lit exactement count octets, renvoie -1 en cas d'erreur ou de fin de fichier */
+static int read_all(int fd, char *buf, size_t count)
+{
+    ssize_t n;
+
+    while (count > 0) {
+        n = thread_read(fd, buf, count);
+        if (n <= 0)
+            return -1;
+        buf += n;
+        count -= n;
+    }
+    return 0;
+}
+
+static void * pipe_writer(void *dummy __attribute__((unused)))
+{
+    thread_write(pipefd[1], "ok", 2);
+    return NULL;
+}
+
+static void * echo(void *_fd)
+{
+    int fd = (intptr_t) _fd;
+    char buf[MSG_SIZE];
+    ssize_t n;
+
+    while ((n = thread_read(fd, buf, sizeof(buf))) > 0)
+        if (thread_write(fd, buf, n) != n)
+            break;
+    close(fd);
+    return NULL;
+}
+
+static void * acceptor(void *_listenfd)
+{
+    int listenfd = (intptr_t) _listenfd;
+    int i, fd, err;
+
+    for(i=0; i<nb; i++) {
+        fd = thread_accept(listenfd, NULL, NULL);
+        assert(fd >= 0);
+        err = thread_create(&echo_th[i], echo, (void*)((intptr_t)fd));
+        assert(!err);
+    }
+    return NULL;
+}
+
+static void * client(void *_id)
+{
+    int id = (intptr_t) _id;
+    char msg[MSG_SIZE], reply[MSG_SIZE];
+    intptr_t ok = 0;
+    int i, fd;
+
+    /* un client sur deux se connecte avec une socket déjà non bloquante */
+    fd = socket(AF_INET, SOCK_STREAM | (id % 2 ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0 || thread_connect(fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) != 0) {
+        perror("connect");
+        return (void *) ok;
+    }
+
+    for(i=0; i<ROUNDS; i++) {
+        snprintf(msg, sizeof(msg), "message %d du client %d", i, id);
+        if (thread_write(fd, msg, sizeof(msg)) != sizeof(msg) || read_all(fd, reply, sizeof(reply)) != 0)
+            break;
+        if (memcmp(msg, reply, sizeof(msg)) == 0)
+            ok++;
+    }
+
+    close(fd);
+    return (void *) ok;
+}
+
+int main(int argc, char *argv[])
+{
+    thread_t th, *client_th;
+    struct pollfd pfd, pfds[2];
+    socklen_t len = sizeof(server_addr);
+    struct timeval tv1, tv2;
+    unsigned long us;
+    char buf[2];
+    void *res;
+    int i, err, listenfd, echoed = 0;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de connexions\n");
+        return -1;
+    }
+    nb = atoi(argv[1]);
+
+    /* un tube vide n'est pas prêt, puis un autre thread y écrit */
+    err = pipe(pipefd);
+    assert(!err);
+    pfd.fd = pipefd[0];
+    pfd.events = POLLIN;
+    if (thread_poll(&pfd, 1, 10) != 0) {
+        printf("thread_poll n'a pas expiré sur un tube vide\n");
+        return EXIT_FAILURE;
+    }
+    pfd.fd = -1;
+    pfd.revents = POLLERR;
+    if (thread_poll(&pfd, 1, 10) != 0 || pfd.revents != 0) {
+        printf("thread_poll n'a pas ignoré un descripteur négatif\n");
+        return EXIT_FAILURE;
+    }
+    err = thread_create(&th, pipe_writer, NULL);
+    assert(!err);
+    pfds[0].fd = pfds[1].fd = pipefd[0];
+    pfds[0].events = pfds[1].events = POLLIN;
+    if (thread_poll(pfds, 2, 10000) != 2 || !(pfds[0].revents & POLLIN) || !(pfds[1].revents & POLLIN)) {
+        printf("thread_poll n'a pas vu le tube donné deux fois devenir prêt\n");
+        return EXIT_FAILURE;
+    }
+    if (read_all(pipefd[0], buf, 2) != 0 || memcmp(buf, "ok", 2) != 0) {
+        printf("thread_read n'a pas lu ce qu'un autre thread a écrit\n");
+        return EXIT_FAILURE;
+    }
+    thread_join(th, NULL);
+    if ((fcntl(pipefd[0], F_GETFL) | fcntl(pipefd[1], F_GETFL)) & O_NONBLOCK) {
+        printf("thread_read/thread_write ont laissé le tube en mode non bloquant\n");
+        return EXIT_FAILURE;
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+
+    /* serveur sur un port choisi par le système */
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listenfd >= 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) != 0
+        || listen(listenfd, SOMAXCONN) != 0
+        || getsockname(listenfd, (struct sockaddr *) &server_addr, &len) != 0) {
+        perror("bind");
+        return EXIT_FAILURE;
+    }
+
+    echo_th = malloc(nb * sizeof(*echo_th));
+    client_th = malloc(nb * sizeof(*client_th));
+    if (!echo_th || !client_th) {
+        perror("malloc");
+        return -1;
+    }
+
+    gettimeofday(&tv1, NULL);
+    err = thread_create(&th, acceptor, (void*)((intptr_t)listenfd));
+    assert(!err);
+    for(i=0; i<nb; i++) {
+        err = thread_create(&client_th[i], client, (void*)((intptr_t)i));
+        assert(!err);
+    }
+    for(i=0; i<nb; i++) {
+        err = thread_join(client_th[i], &res);
+        assert(!err);
+        echoed += (intptr_t) res;
+    }
+    thread_join(th, NULL);
+    for(i=0; i<nb; i++)
+        thread_join(echo_th[i], NULL);
+    gettimeofday(&tv2, NULL);
+    us = (tv2.tv_sec-tv1.tv_sec)*1000000+(tv2.tv_usec-tv1.tv_usec);
+
+    close(listenfd);
+    free(client_th);
+    free(echo_th);
+
+    if (echoed != nb * ROUNDS) {
+        printf("%d échos corrects sur %d\n", echoed, nb * ROUNDS);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d connexions servies avec %d échos chacune en %lu us\n", nb, ROUNDS, us);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "thread.h"
+
+/* test des entrées/sorties sur fichiers: copie d'un fichier par morceaux.
+ *
+ * le main écrit un fichier temporaire de nb morceaux, puis nb threads en
+ * copient chacun un morceau dans un second fichier avec thread_pread() et
+ * thread_pwrite(), à leur position. un dernier thread_fsync() force l'écriture
+ * sur le disque, puis la copie est relue et comparée à l'original.
+ * avec io_uring, les lectures et écritures des threads sont soumises ensemble.
+ *
+ * valgrind doit etre content.
+ * La durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ *
+ * support nécessaire:
+ * - thread_create()
+ * - thread_join() avec récupération de la valeur de retour
+ * - thread_pread()/thread_pwrite()
+ * - thread_fsync()
+ */
+
+#define CHUNK 4096
+
+int srcfd, dstfd;
+
+/* remplit un morceau avec un motif qui dépend de sa position */
+static void fill(char *buf, int id)
+{
+    int i;
+
+    for(i=0; i<CHUNK; i++)
+        buf[i] = (char) (id * 31 + i);
+}
+
+static void * copy(void *_id)
+{
+    int id = (intptr_t) _id;
+    off_t offset = (off_t) id * CHUNK;
+    char buf[CHUNK];
+
+    if (thread_pread(srcfd, buf, CHUNK, offset) != CHUNK)
+        return (void *) -1;
+    if (thread_pwrite(dstfd, buf, CHUNK, offset) != CHUNK)
+        return (void *) -1;
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    char src[] = "/tmp/92-io-copy-src-XXXXXX", dst[] = "/tmp/92-io-copy-dst-XXXXXX";
+    char buf[CHUNK], expected[CHUNK];
+    thread_t *th;
+    struct timeval tv1, tv2;
+    unsigned long us;
+    void *res;
+    int i, err, nb, failed = 0;
+
+    if (argc < 2) {
+        printf("argument manquant: nombre de threads\n");
+        return -1;
+    }
+    nb = atoi(argv[1]);
+
+    srcfd = mkstemp(src);
+    dstfd = mkstemp(dst);
+    th = malloc(nb * sizeof(*th));
+    if (srcfd < 0 || dstfd < 0 || !th) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(src);
+    unlink(dst);
+
+    for(i=0; i<nb; i++) {
+        fill(buf, i);
+        if (pwrite(srcfd, buf, CHUNK, (off_t) i * CHUNK) != CHUNK) {
+            perror("pwrite");
+            return -1;
+        }
+    }
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<nb; i++) {
+        err = thread_create(&th[i], copy, (void*)((intptr_t)i));
+        assert(!err);
+    }
+    for(i=0; i<nb; i++) {
+        err = thread_join(th[i], &res);
+        assert(!err);
+        if (res != NULL)
+            failed++;
+    }
+    err = thread_fsync(dstfd);
+    assert(!err);
+    gettimeofday(&tv2, NULL);
+    us = (tv2.tv_sec-tv1.tv_sec)*1000000+(tv2.tv_usec-tv1.tv_usec);
+
+    for(i=0; i<nb && !failed; i++) {
+        fill(expected, i);
+        if (pread(dstfd, buf, CHUNK, (off_t) i * CHUNK) != CHUNK || memcmp(buf, expected, CHUNK) != 0)
+            failed++;
+    }
+
+    close(srcfd);
+    close(dstfd);
+    free(th);
+
+    if (failed) {
+        printf("copie INCORRECTE: %d morceaux\n", failed);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d morceaux de %d octets copiés par %d threads en %lu us\n", nb, CHUNK, nb, us);
+    return EXIT_SUCCESS;
+}